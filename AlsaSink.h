@@ -0,0 +1,134 @@
+/*
+	This file contains the Linux output of the audio engine, built on top of ALSA.
+	Any ALSA pcm name can be used, including the "null" and "file" plugins for testing on headless machines
+*/
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <alsa/asoundlib.h>
+#include "AudioSink.h"
+
+class AlsaAudioSink : public IAudioSink {
+public:
+    explicit AlsaAudioSink(std::string device = "default") : _device(std::move(device)) {
+    }
+
+    ~AlsaAudioSink() override { Close(); }
+
+    bool Open(const AudioFormat &format, const unsigned int blockCount, const unsigned int blockSamples) override {
+        _blockFrames = blockSamples / format.Channels;
+        _sampleRate = format.SampleRate;
+        _blockCount = blockCount;
+        _queueLimit = blockCount;
+        _underruns = 0;
+        _block.assign(static_cast<size_t>(blockSamples) * format.BytesPerSample(), 0);
+
+        snd_pcm_format_t pcmFormat;
+        if (format.IsFloat)
+            pcmFormat = SND_PCM_FORMAT_FLOAT_LE;
+        else if (format.BitsPerSample == 16)
+            pcmFormat = SND_PCM_FORMAT_S16_LE;
+        else if (format.BitsPerSample == 24)
+            pcmFormat = SND_PCM_FORMAT_S24_3LE;
+        else if (format.BitsPerSample == 32)
+            pcmFormat = SND_PCM_FORMAT_S32_LE;
+        else
+            return false;
+
+        int error = snd_pcm_open(&_pcm, _device.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+        if (error < 0) {
+            std::cout << "snd_pcm_open() FAILED: " << snd_strerror(error) << std::endl;
+            _pcm = nullptr;
+            return false;
+        }
+
+        // the device buffer holds the same amount of audio as all the engine blocks together
+        const auto latency = static_cast<unsigned int>(
+            static_cast<unsigned long long>(blockCount) * _blockFrames * 1000000ull / format.SampleRate);
+
+        error = snd_pcm_set_params(_pcm, pcmFormat, SND_PCM_ACCESS_RW_INTERLEAVED, format.Channels,
+                                   format.SampleRate, 1, latency);
+        if (error < 0) {
+            std::cout << "snd_pcm_set_params() FAILED: " << snd_strerror(error) << std::endl;
+            Close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void Close() override {
+        if (_pcm == nullptr)
+            return;
+
+        snd_pcm_drain(_pcm);
+        snd_pcm_close(_pcm);
+        _pcm = nullptr;
+    }
+
+    // The device buffer always has room for every block, a lower queue limit is kept by sleeping until
+    // enough of the queued audio has been played
+    void *AcquireBlock() override {
+        const snd_pcm_sframes_t allowed = static_cast<snd_pcm_sframes_t>(_queueLimit - 1) * _blockFrames;
+        snd_pcm_sframes_t delay = 0;
+        if (_pcm != nullptr && snd_pcm_delay(_pcm, &delay) == 0 && delay > allowed)
+            std::this_thread::sleep_for(std::chrono::microseconds((delay - allowed) * 1000000ll / _sampleRate));
+
+        return _block.data();
+    }
+
+    // Blocks until the device buffer has room for the whole block
+    void SubmitBlock() override {
+        const char *data = _block.data();
+        snd_pcm_uframes_t framesLeft = _blockFrames;
+        const size_t frameBytes = _block.size() / _blockFrames;
+
+        while (framesLeft > 0) {
+            const snd_pcm_sframes_t written = snd_pcm_writei(_pcm, data, framesLeft);
+            if (written < 0) {
+                if (written == -EPIPE)
+                    ++_underruns;
+
+                // underrun or suspend, recover and write the rest of the block again
+                if (snd_pcm_recover(_pcm, static_cast<int>(written), 1) < 0)
+                    return;
+                continue;
+            }
+
+            framesLeft -= written;
+            data += written * frameBytes;
+        }
+    }
+
+    bool IsRealTime() const override { return true; }
+
+    unsigned int QueuedBlocks() const override {
+        snd_pcm_sframes_t delay = 0;
+        if (_pcm == nullptr || snd_pcm_delay(_pcm, &delay) < 0 || delay < 0)
+            return 0;
+        return static_cast<unsigned int>(delay / _blockFrames);
+    }
+
+    uint64_t Underruns() const override { return _underruns; }
+
+    void SetQueueLimit(const unsigned int blocks) override {
+        _queueLimit = std::min(std::max(blocks, 1u), _blockCount);
+    }
+
+private:
+    std::string _device;
+    snd_pcm_t *_pcm{};
+    unsigned int _blockFrames{};
+    unsigned int _sampleRate{};
+    unsigned int _blockCount{};
+    std::atomic<unsigned int> _queueLimit{};
+    std::vector<char> _block;
+    std::atomic<uint64_t> _underruns{};
+};
@@ -6,43 +6,81 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
 #include "NoiseMaker.h"
+#include "AudioSink.h"
+#ifdef _WIN32
+#include "WinMMSink.h"
+#endif
+#ifdef MUVE_HAVE_ALSA
+#include "AlsaSink.h"
+#endif
 #include "SynthUtils.h"
+#include "InstrumentDefinition.h"
+#include "Mixer.h"
+#include "RenderCache.h"
 #include "NoteGenarator.h"
 #include "StateMachine.h"
 #include "SessionEvaluator.h"
 #include "SocketServer.h"
+#include "MoodSource.h"
+#include "VoiceEngine.h"
+
+constexpr unsigned int SAMPLE_RATE = 44100;
+constexpr unsigned int MAX_NOTES = 256;
+constexpr unsigned int MAX_CHANNELS = 8;
 
 SocketServer *Server;
 
 AI::StateMachine *AISystem;
 
 std::atomic<double> DeltaTime;
+// how far ahead of the render thread the sequencer hands its notes over, it has to cover a block and a poll
+constexpr uint64_t SEQUENCER_LOOKAHEAD_FRAMES = SAMPLE_RATE / 20;
+std::atomic<bool> EndSessionRequested;
 
-std::vector<synth::Note> NotesPlaying;
+synth::VoicePool NotesPlaying(MAX_NOTES);
 std::mutex notesMutex;
-// Instruments
-synth::KeyboardInstrument SynthKeyboard;
-synth::InstrumentBell Bell;
-synth::InstrumentBell8 Bell8;
-synth::InstrumentHarmonica Harmonica;
-synth::InstrumentDrumKick Kick;
-synth::InstrumentDrumSnare Snare;
-synth::InstrumentDrumHihat HitHat;
-
-synth::InstrumentCordPlayer CordPlayer;
+// Instruments, copied from the instrument library at startup
+synth::InstrumentLibrary Instruments;
+
+synth::AdditiveInstrument SynthKeyboard;
+synth::AdditiveInstrument Bell;
+synth::AdditiveInstrument Bell8;
+synth::AdditiveInstrument Harmonica;
+synth::AdditiveInstrument Kick;
+synth::AdditiveInstrument Snare;
+synth::AdditiveInstrument HitHat;
+
+synth::AdditiveInstrument CordPlayer;
 // The base works for both normal and diminished chords
-synth::InstrumentCordBase CordBase;
-synth::InstrumentUserSensor UserSensor;
+synth::AdditiveInstrument CordBase;
+synth::AdditiveInstrument UserSensor;
+
+synth::AdditiveInstrument CordDiminished;
+synth::AdditiveInstrument UserDiminished;
 
-synth::InstrumentCordDiminished CordDiminished;
-synth::InstrumentUserSensorDiminished UserDiminished;
+synth::AdditiveInstrument CordInversion;
+synth::AdditiveInstrument BaseInversion;
+synth::AdditiveInstrument UserInversion;
 
-synth::InstrumentCordInversion CordInversion;
-synth::InstrumentCordBaseInverted BaseInversion;
-synth::InstrumentUserSensorInversion UserInversion;
+// instrument that doubles the player phrase, only used by offline renders
+synth::InstrumentBase *PhraseInstrument = nullptr;
 
-synth::LowPassFilter LowFilter;
+// renders the playing notes into the mixer buses, only used by the render thread
+synth::VoiceEngine Engine;
+// notes of the instruments with a life time, rendered by the control thread. nullptr when it is turned off
+synth::RenderCache *NoteCache = nullptr;
+synth::Mixer Mixer;
+// master bus effect that follows the mood, owned by the mixer
+synth::FilterEffect<synth::LowPassFilter> *MoodFilter = nullptr;
 
 // backing track cords according to their measure
 // test AI input
@@ -79,18 +117,6 @@ int CurrentBarIndex = 0;
 // twelve bar blues cord progression in the A minor scale
 char TwelveBarBluesCordProgressionTest[12] = {'A', 'D', 'A', 'A', 'D', 'D', 'A', 'A', 'E', 'D', 'A', 'E'};
 
-// utility function to safely remove objects from a vector
-//Note: there multiple ways for doing this
-void SafeRemove(std::vector<synth::Note> &notes, bool (*lambda)(synth::Note const &note)) {
-    auto noteToRemove = NotesPlaying.begin();
-    while (noteToRemove != notes.end()) {
-        if (!lambda(*noteToRemove))
-            noteToRemove = notes.erase(noteToRemove);
-        else
-            ++noteToRemove;
-    }
-}
-
 // utility function for mapping values. 
 // Here result is the reversed because it was useful for this particular case
 double MapValueReverse(const double &value, const double &max1, const double &min1,
@@ -100,19 +126,107 @@ double MapValueReverse(const double &value, const double &max1, const double &mi
     return max2 - resultMapped;
 }
 
-double MakeNoise(int channel, double time) {
-    double mixedOutput = 0.0;
+// The mood low pass and the master volume are the effects of the master bus, the buses are sized for the
+// blocks of the audio output so the render thread does not allocate
+void SetupMixer(const unsigned int blockSamples) {
+    MoodFilter = new synth::FilterEffect<synth::LowPassFilter>();
+    Mixer.Master.Effects.emplace_back(MoodFilter);
+    Mixer.Master.Gain = 0.1;
+    Mixer.Prepare(blockSamples);
+}
+
+// Renders a whole block of audio, the notes are only locked, filtered and cleaned once per block.
+// Every note is synthesized once per frame into the bus of its instrument, the buses are mixed once per block.
+// Mono outputs get the plain voice, stereo outputs the left/right gains and any channel after the second one is
+// left silent
+void RenderNoise(float *out, const uint32_t frames, const uint32_t channels, const uint64_t startFrame, void *) {
+    const double timeStep = 1.0 / static_cast<double>(SAMPLE_RATE);
+    const uint32_t outputChannels = std::min(channels, MAX_CHANNELS);
     std::lock_guard<std::mutex> lg(notesMutex);
 
-    for (synth::Note &note: NotesPlaying) {
-        mixedOutput += note.Sound(time);
+    // the mood only changes every few blocks, the cutoff moves to it over this one
+    MoodFilter->SetFilterPresets(0.1, MapValueReverse(Server->Mood, 90.0, 10.0, 3.0, 0.0), frames);
+
+    std::fill(out, out + frames * channels, 0.0f);
+    Mixer.Clear(frames);
+
+    if (NoteCache != nullptr)
+        NoteCache->BeginBlock(startFrame, frames);
+
+    const bool isStereo = outputChannels > 1;
+    Engine.RenderNotes(NotesPlaying, Mixer.Left(), isStereo ? Mixer.Right() : nullptr, frames, startFrame, timeStep);
+    Mixer.Mix(out, frames, channels);
+}
+
+// Creates the audio output from a "--sink" option: null, wav:<path>, alsa[:<pcm name>] or winmm[:<device>]
+// An empty option picks the sound card of the platform
+std::unique_ptr<IAudioSink> CreateAudioSink(const std::string &option) {
+    const std::string type = option.substr(0, option.find(':'));
+    const std::string argument = option.find(':') == std::string::npos ? "" : option.substr(option.find(':') + 1);
+
+    if (type == "null")
+        return std::unique_ptr<IAudioSink>(new NullAudioSink());
+    if (type == "wav")
+        return std::unique_ptr<IAudioSink>(new WavFileAudioSink(argument.empty() ? "Muve.wav" : argument));
+#ifdef MUVE_HAVE_ALSA
+    if (type == "alsa" || type.empty())
+        return std::unique_ptr<IAudioSink>(new AlsaAudioSink(argument.empty() ? "default" : argument));
+#endif
+#ifdef _WIN32
+    if (type == "winmm" || type.empty()) {
+        const std::vector<std::wstring> devices = WinMMAudioSink::Enumerate();
+        if (!argument.empty())
+            return std::unique_ptr<IAudioSink>(new WinMMAudioSink(std::wstring(argument.begin(), argument.end())));
+        if (!devices.empty())
+            return std::unique_ptr<IAudioSink>(new WinMMAudioSink(devices[0]));
     }
+#endif
+
+    std::cout << "No audio output \"" << option << "\" available, using the null output\n";
+    return std::unique_ptr<IAudioSink>(new NullAudioSink());
+}
+
+// One line summary of the render cache, how often a note was already rendered and what the cache holds
+void PrintRenderCache() {
+    std::cout << "Render cache: " << NoteCache->HitRate() * 100.0 << "% hits (" << NoteCache->Hits() << "/"
+            << NoteCache->Hits() + NoteCache->Misses() << ")  Notes: " << NoteCache->NoteCount() << "  Memory: "
+            << static_cast<double>(NoteCache->MemoryBytes()) / (1024.0 * 1024.0) << " MB" << std::endl;
+}
+
+// One line summary of the render telemetry, times are in microseconds
+void PrintTelemetry(const TelemetrySnapshot &stats, const unsigned int queueLimit) {
+    std::cout << "Blocks: " << stats.Blocks
+            << "  Render avg/p99/max: " << stats.RenderMicros.Average << "/" << stats.RenderMicros.P99 << "/"
+            << stats.RenderMicros.Max
+            << "  Headroom min/p99: " << stats.HeadroomMicros.Min << "/" << stats.HeadroomMicros.P99
+            << "  Queue min/avg/limit: " << stats.QueueDepth.Min << "/" << stats.QueueDepth.Average << "/" << queueLimit
+            << "  Underruns: " << stats.Underruns << "  Stolen voices: " << NotesPlaying.StolenVoices() << std::endl;
+    if (NoteCache != nullptr)
+        PrintRenderCache();
+}
 
-    SafeRemove(NotesPlaying, [](synth::Note const &note) { return note.IsActive; });
+// Number from a command line option, 'fallback' when the option is not a number
+template<typename T>
+T ParseNumber(const std::string &option, const char *name, const T fallback) {
+    std::stringstream stream(option);
+    T value;
+    if (stream >> value && (stream >> std::ws).eof())
+        return value;
+    std::cout << "Could not read " << name << " \"" << option << "\", using " << fallback << "\n";
+    return fallback;
+}
 
-    LowFilter.SetFilterPresets(0.1, MapValueReverse(Server->Mood, 90.0, 10.0, 3.0, 0.0));
-    return LowFilter.FilterOutput(mixedOutput) * 0.1;
-    //return mixedOutput * 0.1; // master volume
+// Output sample format from a "--format" option: int16, int24, int32 or float32
+SampleFormat ParseSampleFormat(const std::string &option) {
+    if (option == "int24")
+        return SAMPLE_INT24;
+    if (option == "int32")
+        return SAMPLE_INT32;
+    if (option == "float32")
+        return SAMPLE_FLOAT32;
+    if (option != "int16")
+        std::cout << "Unknown sample format \"" << option << "\", using int16\n";
+    return SAMPLE_INT16;
 }
 
 void RefreshPhrase(synth::Sequencer *sequencer) {
@@ -129,6 +243,8 @@ void RefreshPhrase(synth::Sequencer *sequencer) {
 
     sequencer->PlayBar(&CordDiminished, currentCordBar);
     sequencer->PlayBar(&UserDiminished, currentCordBar);
+    if (PhraseInstrument != nullptr)
+        sequencer->PlayBar(PhraseInstrument, currentCordBar);
 
     currentCordBar[0] = TwelveBarBluesCordProgressionTest[CurrentBarIndex];
 
@@ -155,6 +271,8 @@ void RefreshPhrase(synth::Sequencer *sequencer) {
             sequencer->PlayBar(&UserSensor, currentPlayerBar);
             break;
     }
+    if (PhraseInstrument != nullptr)
+        sequencer->PlayBar(PhraseInstrument, currentPlayerBar);
 
     //std::cout << "Value: " << MapValue(Server->Mood)  << std::endl;
     Evalautor::OutPutHistory.emplace_back(Server->Mood, outPut->Change);
@@ -162,12 +280,260 @@ void RefreshPhrase(synth::Sequencer *sequencer) {
     //++testAIIndex %= 24;
 }
 
-int main() {
+// Drum loop every session starts with, the rest of the song comes from RefreshPhrase
+void StartBackingTrack(synth::Sequencer &sequencer) {
+    sequencer.PlayBar(&Snare, "....A.......A...");
+    sequencer.PlayBar(&Kick, "A...A...A...A...");
+    sequencer.PlayBar(&HitHat, "A.A.A.A.A.A.A.A.");
+}
+
+// Reads the built in instruments, then the ones in 'path' if there is one, which replace them by name
+bool LoadInstruments(const std::string &path) {
+    std::string error;
+    if (!Instruments.Load(synth::BUILT_IN_INSTRUMENTS, error)) {
+        std::cout << "Built in instruments, " << error << std::endl;
+        return false;
+    }
+    if (!path.empty()) {
+        std::ifstream file(path);
+        if (!file)
+            error = "the file can not be opened";
+        if (!file || !Instruments.Load(file, error)) {
+            std::cout << "Could not read the instruments in \"" << path << "\", " << error << std::endl;
+            return false;
+        }
+    }
+
+    // the drums play the same few notes all song long, the sequencer notes are rendered once here
+    std::vector<int> sequencerNotes;
+    for (const auto &note: synth::NoteToScaleMap)
+        sequencerNotes.push_back(note.second);
+    Instruments.PrepareOneShots(SAMPLE_RATE, sequencerNotes);
+    Instruments.SetCache(NoteCache);
+
+    const std::pair<const char *, synth::AdditiveInstrument *> named[] = {
+        {"standard", &SynthKeyboard}, {"bell", &Bell}, {"bell8", &Bell8}, {"harmonica", &Harmonica},
+        {"kick", &Kick}, {"snare", &Snare}, {"hihat", &HitHat}, {"cord-player", &CordPlayer},
+        {"cord-base", &CordBase}, {"user-sensor", &UserSensor}, {"cord-diminished", &CordDiminished},
+        {"user-sensor-diminished", &UserDiminished}, {"cord-inversion", &CordInversion},
+        {"cord-base-inverted", &BaseInversion}, {"user-sensor-inversion", &UserInversion}
+    };
+    for (const auto &instrument: named) {
+        if (const synth::AdditiveInstrument *loaded = Instruments.Find(instrument.first))
+            *instrument.second = *loaded;
+        instrument.second->Cache = NoteCache;
+    }
+    return true;
+}
+
+// Instrument from an "--instrument" option, by name or by its number in the console menu
+synth::InstrumentBase *ParseInstrument(const std::string &option) {
+    if (option == "1" || option == "standard")
+        return &SynthKeyboard;
+    if (option == "2" || option == "bell")
+        return &Bell;
+    if (option == "3" || option == "bell8")
+        return &Bell8;
+    if (option == "4" || option == "harmonica")
+        return &Harmonica;
+    if (synth::InstrumentBase *instrument = Instruments.Find(option))
+        return instrument;
+    if (option != "none")
+        std::cout << "Unknown instrument \"" << option << "\", the phrase is only played by the user sensor\n";
+    return nullptr;
+}
+
+// Renders 'bars' bars of the song straight into a WAV file, with no device and no waiting: the sequencer, the
+// AI and the mix run in the same loop, one block at a time. The mood comes from 'mood' instead of the sensor
+int RenderOffline(const std::string &path, const unsigned int bars, const float tempo, const MoodSource &mood,
+                  const SampleFormat sampleFormat, const unsigned int channels, const unsigned int blockFrames,
+                  const bool dither) {
+    AudioFormat format{};
+    format.SampleRate = SAMPLE_RATE;
+    format.Channels = channels;
+    format.BitsPerSample = SampleFormatBits(sampleFormat);
+    format.IsFloat = sampleFormat == SAMPLE_FLOAT32;
+
+    WavFileAudioSink sink(path);
+    if (!sink.Open(format, 1, blockFrames * channels)) {
+        std::cout << "Could not open \"" << path << "\" for writing\n";
+        return 1;
+    }
+
+    synth::Sequencer sequencer(RefreshPhrase, tempo);
+    StartBackingTrack(sequencer);
+
+    const double barFrames = sequencer.BeatTime * sequencer.TotalBeats * SAMPLE_RATE;
+    const auto totalFrames = static_cast<uint64_t>(std::llround(bars * barFrames));
+    std::vector<float> mixBuffer(static_cast<size_t>(blockFrames) * channels);
+    DitherState ditherState;
+    ditherState.Enabled = dither;
+
+    const auto renderStart = std::chrono::steady_clock::now();
+    for (uint64_t frame = 0; frame < totalFrames; frame += blockFrames) {
+        const auto frames = static_cast<uint32_t>(std::min<uint64_t>(blockFrames, totalFrames - frame));
+
+        // the mood the AI reads when a bar ends is the one at that point of the curve
+        Server->Mood = static_cast<int>(std::lround(mood.MoodAt(static_cast<double>(frame) / barFrames)));
+        if (sequencer.Update(frame, frame + frames, SAMPLE_RATE) > 0) {
+            std::lock_guard<std::mutex> lg(notesMutex);
+            for (const synth::Note &note: sequencer.Notes)
+                NotesPlaying.Allocate(note);
+        }
+
+        RenderNoise(mixBuffer.data(), frames, channels, frame, nullptr);
+        // the notes asked for are ready for the next block, like a control thread that keeps up
+        if (NoteCache != nullptr)
+            while (NoteCache->RenderPending()) {}
+        ConvertSamples(sampleFormat, mixBuffer.data(), sink.AcquireBlock(), frames * channels, ditherState);
+        sink.SubmitFrames(frames);
+    }
+    sink.Close();
+
+    const double renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+    const double audioSeconds = static_cast<double>(totalFrames) / SAMPLE_RATE;
+    std::cout << "Rendered " << bars << " bars (" << audioSeconds << " s) in " << renderSeconds << " s, real-time factor "
+            << audioSeconds / std::max(renderSeconds, 1e-9) << "x\n";
+    if (NoteCache != nullptr)
+        PrintRenderCache();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
     std::cout << "Muve Started!\n";
 
+    // the wave and pitch tables are built here so the render thread never has to
+    synth::WavetableBank::Get();
+    synth::PitchTable::Get();
+
+    std::string sinkOption;
+    unsigned int blocks = 8;
+    unsigned int blockSamples = 512; // per channel
+    unsigned int channels = 1;
+    SampleFormat sampleFormat = SAMPLE_INT16;
+    bool dither = false;
+    bool showStats = false;
+    RealTimeOptions realTime;
+    std::string renderPath;
+    unsigned int renderBars = 0;
+    float tempo = 120.0f;
+    MoodSource mood;
+    std::string instrumentOption = "none";
+    std::string instrumentsPath;
+    bool adaptiveQueue = false;
+    unsigned int renderCacheMegabytes = 16; // 0 turns the cache off
+    unsigned int minBlocks = 2;
+    for (int i = 1; i < argc; i++) {
+        const std::string argument = argv[i];
+        if (argument == "--sink" && i + 1 < argc)
+            sinkOption = argv[++i];
+        else if (argument == "--blocks" && i + 1 < argc)
+            blocks = std::max(2, ParseNumber(argv[++i], "the block count", 8));
+        else if (argument == "--block-samples" && i + 1 < argc)
+            blockSamples = std::max(16, ParseNumber(argv[++i], "the block size", 512));
+        else if (argument == "--channels" && i + 1 < argc)
+            channels = std::min(std::max(1, ParseNumber(argv[++i], "the channel count", 1)),
+                                static_cast<int>(MAX_CHANNELS));
+        else if (argument == "--format" && i + 1 < argc)
+            sampleFormat = ParseSampleFormat(argv[++i]);
+        else if (argument == "--dither")
+            dither = true;
+        else if (argument == "--stats")
+            showStats = true;
+        else if (argument == "--render" && i + 1 < argc)
+            renderBars = std::max(1, ParseNumber(argv[++i], "the bar count", 1));
+        else if (argument == "--out" && i + 1 < argc)
+            renderPath = argv[++i];
+        else if (argument == "--tempo" && i + 1 < argc)
+            tempo = std::max(1.0f, ParseNumber(argv[++i], "the tempo", 120.0f));
+        else if (argument == "--instrument" && i + 1 < argc)
+            instrumentOption = argv[++i];
+        else if (argument == "--instruments" && i + 1 < argc)
+            instrumentsPath = argv[++i];
+        else if (argument == "--mood" && i + 1 < argc) {
+            const std::string option = argv[++i];
+            if (!mood.Parse(option))
+                std::cout << "Could not read mood \"" << option << "\", using a constant mood of 10\n";
+        } else if (argument == "--steal" && i + 1 < argc) {
+            // the note a full voice pool gives up for a new one
+            const std::string option = argv[++i];
+            if (option == "oldest")
+                NotesPlaying.StealMode = synth::STEAL_OLDEST;
+            else if (option == "quietest")
+                NotesPlaying.StealMode = synth::STEAL_QUIETEST;
+            else
+                std::cout << "Unknown steal mode \"" << option << "\", use oldest or quietest\n";
+        } else if ((argument == "--mute" || argument == "--bus-gain") && i + 1 < argc) {
+            // drums, chords, bass or user
+            const int bus = synth::ParseBus(argv[++i]);
+            if (bus < 0)
+                std::cout << "Unknown bus \"" << argv[i] << "\", use drums, chords, bass or user\n";
+            if (argument == "--bus-gain" && i + 1 < argc) {
+                const double gain = ParseNumber(argv[++i], "the bus gain", 1.0);
+                if (bus >= 0)
+                    Mixer.Buses[bus].Gain = gain;
+            } else if (argument == "--mute" && bus >= 0)
+                Mixer.Buses[bus].Muted = true;
+        } else if (argument == "--bus-filter" && i + 3 < argc) {
+            // <bus> <lowpass|highpass|bandpass|notch|peak> <hertz>, several filters on a bus run in order
+            const int bus = synth::ParseBus(argv[++i]);
+            const int type = synth::ParseFilterType(argv[++i]);
+            const double cutoff = ParseNumber(argv[++i], "the filter cutoff", 1000.0);
+            if (bus < 0 || type < 0)
+                std::cout << "Could not read the bus filter, use --bus-filter <bus> <type> <hertz>\n";
+            else
+                Mixer.Buses[bus].Effects.emplace_back(
+                    new synth::StateVariableEffect(type, cutoff, 0.7071, SAMPLE_RATE));
+        } else if (argument == "--bus-butterworth" && i + 3 < argc) {
+            // <bus> <lowpass|highpass> <hertz>, 24 dB per octave
+            const int bus = synth::ParseBus(argv[++i]);
+            const int type = synth::ParseFilterType(argv[++i]);
+            const double cutoff = ParseNumber(argv[++i], "the filter cutoff", 1000.0);
+            if (bus < 0 || (type != synth::FILTER_LOW_PASS && type != synth::FILTER_HIGH_PASS))
+                std::cout << "Could not read the bus filter, use --bus-butterworth <bus> <lowpass|highpass> <hertz>\n";
+            else
+                Mixer.Buses[bus].Effects.emplace_back(new synth::ButterworthEffect<2>(type, cutoff, SAMPLE_RATE));
+        } else if (argument == "--render-cache" && i + 1 < argc) {
+            renderCacheMegabytes = std::max(0, ParseNumber(argv[++i], "the render cache size", 16));
+        } else if (argument == "--adaptive") {
+            adaptiveQueue = true;
+            // the block count becomes the most the queue can grow to
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+                minBlocks = std::max(1, ParseNumber(argv[++i], "the smallest block count", 2));
+        } else if (argument == "--realtime")
+            realTime.Enabled = true;
+        else if (argument == "--core" && i + 1 < argc)
+            realTime.Core = ParseNumber(argv[++i], "the core", -1);
+        else if (argument == "--no-mlock")
+            realTime.LockMemory = false;
+    }
+
+    if (renderCacheMegabytes > 0) {
+        // static storage keeps the cache lines of its rings aligned, a plain new would not before C++17
+        static synth::RenderCache renderCache(static_cast<size_t>(renderCacheMegabytes) * 1024 * 1024, SAMPLE_RATE);
+        NoteCache = &renderCache;
+    }
+    if (!LoadInstruments(instrumentsPath))
+        return 1;
+    SetupMixer(blockSamples);
+    Engine.Prepare(NotesPlaying.Capacity());
+    PhraseInstrument = ParseInstrument(instrumentOption);
+
     Server = new SocketServer();
 
+    // offline renders never touch the console, a device or the network
+    if (renderBars > 0) {
+        AISystem = new AI::StateMachine();
+        const int result = RenderOffline(renderPath.empty() ? "muve.wav" : renderPath, renderBars, tempo, mood,
+                                         sampleFormat, channels, blockSamples, dither);
+        delete AISystem;
+        return result;
+    }
+
+#ifdef _WIN32
+    // the keyboard is only played on Windows, elsewhere there is no instrument to choose
     synth::InstrumentBase *chosenInstrument = &SynthKeyboard;
+#endif
 
     std::string userInput;
     while (true) {
@@ -180,11 +546,12 @@ int main() {
             break;
         }
         if (userInput == "n") {
+            UserSensor.Volume = 0;
+#ifdef _WIN32
             std::cout << "Chose and Instrument to play:\n";
             while (true) {
                 std::cout << "Standard(1), Bell(2), Bell-8bit(3), Harmonica(4):";
                 std::cin >> userInput;
-                UserSensor.Volume = 0;
                 if (userInput == "1")
                     break;
                 if (userInput == "2") {
@@ -201,6 +568,7 @@ int main() {
                 }
                 std::cout << "Invalid instrument. Please try again.\n";
             }
+#endif
             break;
         }
         std::cout << "Invalid response. Please try again.\n";
@@ -208,18 +576,38 @@ int main() {
 
     AISystem = new AI::StateMachine();
 
-    const std::vector<std::wstring> devices = NoiseMaker<short>::Enumerate();
-    NoiseMaker<short> sound(devices[0], 44100, 1, 8, 512);
-    sound.SetUserFunction(&MakeNoise);
+    const std::unique_ptr<IAudioSink> sink = CreateAudioSink(sinkOption);
+    const std::unique_ptr<NoiseMakerBase> sound = CreateNoiseMaker(sampleFormat, sink.get(), SAMPLE_RATE, channels,
+                                                                   blocks, blockSamples * channels);
+    sound->SetRenderFunction(&RenderNoise);
+    sound->SetDither(dither);
+    sound->SetAdaptiveQueue(adaptiveQueue, minBlocks);
+
+    if (realTime.Enabled) {
+        // the voice pool is allocated up front, so it is locked and mapped along with the rest of the memory
+        sound->SetRealTime(realTime);
+
+        RealTimeReport report;
+        for (int tries = 0; tries < 1000 && !sound->GetRealTimeReport(report); tries++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        RealTime::PrintReport(report);
+    }
 
     auto oldTime = std::chrono::high_resolution_clock::now();
     double wallTime = 0.0;
+    double statsTime = 0.0;
 
     // Create Sequencer
-    synth::Sequencer sequencer(RefreshPhrase, 120);
-    sequencer.PlayBar(&Snare, "....A.......A...");
-    sequencer.PlayBar(&Kick, "A...A...A...A...");
-    sequencer.PlayBar(&HitHat, "A.A.A.A.A.A.A.A.");
+    synth::Sequencer sequencer(RefreshPhrase, tempo);
+    StartBackingTrack(sequencer);
+
+#ifndef _WIN32
+    std::thread([] {
+        std::cin.ignore();
+        std::cin.get();
+        EndSessionRequested = true;
+    }).detach();
+#endif
 
     bool sessionIsOn = true;
     while (sessionIsOn) {
@@ -227,41 +615,45 @@ int main() {
         DeltaTime = std::chrono::duration<double>(currentTime - oldTime).count();
         wallTime += DeltaTime;
         oldTime = currentTime;
-        double timeNow = sound.GetTime();
+        const uint64_t frameNow = sound->GetFrame();
+
+        // the notes the render thread asked for, one per pass keeps the loop responsive
+        if (NoteCache != nullptr)
+            NoteCache->RenderPending();
 
-        if (sequencer.Update(DeltaTime, timeNow) > 0) {
+        if (sequencer.Update(frameNow, frameNow + SEQUENCER_LOOKAHEAD_FRAMES, SAMPLE_RATE) > 0) {
             std::lock_guard<std::mutex> lg(notesMutex);
-            NotesPlaying.insert(NotesPlaying.end(), std::make_move_iterator(sequencer.Notes.begin()),
-                                std::make_move_iterator(sequencer.Notes.end()));
+            for (const synth::Note &note: sequencer.Notes)
+                NotesPlaying.Allocate(note);
         }
 
+#ifdef _WIN32
         for (int k = 0; k < 17; k++) {
             const short keyState = GetAsyncKeyState(static_cast<unsigned char>("1Q2WE4R5TY7U8I9OP"[k]));
 
             // Check if played note already exists in the current notes being played by the user
             notesMutex.lock();
-            auto noteFound = std::find_if(NotesPlaying.begin(), NotesPlaying.end(),
-                                          [&k, &chosenInstrument](synth::Note const &note) {
-                                              return note.ScalePosition == k - 1 && note.Channel == chosenInstrument;
-                                          });
+            synth::Note *noteFound = NotesPlaying.Find([&k, &chosenInstrument](synth::Note const &note) {
+                return note.ScalePosition == k - 1 && note.Channel == chosenInstrument;
+            });
             // does not have note
-            if (noteFound == NotesPlaying.end()) {
+            if (noteFound == nullptr) {
                 if (keyState & 0x8000) {
-                    synth::Note newNote(k - 1, timeNow, 0.0, true, chosenInstrument);
-                    NotesPlaying.emplace_back(newNote);
+                    synth::Note newNote(k - 1, frameNow, 0, true, chosenInstrument);
+                    NotesPlaying.Allocate(newNote);
                 }
             } else {
                 // note exists in vector
                 if (keyState & 0x8000) // note is being held
                 {
-                    if (noteFound->OffTime > noteFound->OnTime) {
+                    if (noteFound->IsReleased()) {
                         // note was pressed again during released phase
-                        noteFound->OnTime = timeNow;
+                        noteFound->OnFrame = frameNow;
                         noteFound->IsActive = true;
                     }
                 } else {
-                    if (noteFound->OffTime < noteFound->OnTime) // Key released, enter note release phase
-                        noteFound->OffTime = timeNow;
+                    if (!noteFound->IsReleased()) // Key released, enter note release phase
+                        noteFound->OffFrame = std::max(frameNow, noteFound->OnFrame + 1);
                 }
             }
 
@@ -270,11 +662,23 @@ int main() {
 
         // end session if the z key has been pressed
         sessionIsOn = !(GetAsyncKeyState('Z') & 0x8000);
-
-        /*std::cout << "\rNotes: " << NotesPlaying.size() << "  Real Time: " << wallTime << "  CPU Time: " << timeNow <<
-            "  Latency: " << wallTime - timeNow << "   ";*/
+#else
+        // keyboard playing relies on the Windows key state, elsewhere the session ends with a new line on the console
+        sessionIsOn = !EndSessionRequested;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+
+        /*std::cout << "\rNotes: " << NotesPlaying.Count() << "  Real Time: " << wallTime << "  CPU Time: " << sound->GetTime() <<
+            "  Latency: " << wallTime - sound->GetTime() << "   ";*/
+        if (showStats && wallTime - statsTime >= 1.0) {
+            statsTime = wallTime;
+            PrintTelemetry(sound->GetTelemetry().Read(), sound->GetQueueLimit());
+        }
     }
 
+    if (showStats)
+        PrintTelemetry(sound->GetTelemetry().Read(), sound->GetQueueLimit());
+
     Evalautor::EvalauteSession();
 
     delete AISystem;
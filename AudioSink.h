@@ -0,0 +1,161 @@
+/*
+	This file contains the interface NoiseMaker uses to hand audio blocks to an output,
+	and the outputs that do not need a sound card: a null sink and a streaming WAV file sink.
+	Neither of them waits for an audio clock, so they run as fast as the renderer can fill blocks
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct AudioFormat {
+    unsigned int SampleRate;
+    unsigned int Channels;
+    unsigned int BitsPerSample;
+    bool IsFloat;
+
+    unsigned int BytesPerSample() const { return BitsPerSample / 8; }
+
+    unsigned int BytesPerFrame() const { return BytesPerSample() * Channels; }
+};
+
+// Blocks are always handed over in order: AcquireBlock returns the memory of the next block, the caller fills it
+// with 'blockSamples' interleaved samples and then calls SubmitBlock
+class IAudioSink {
+public:
+    virtual ~IAudioSink() = default;
+
+    virtual bool Open(const AudioFormat &format, unsigned int blockCount, unsigned int blockSamples) = 0;
+
+    virtual void Close() = 0;
+
+    // Waits while every block is still held by the device
+    virtual void *AcquireBlock() = 0;
+
+    virtual void SubmitBlock() = 0;
+
+    // False when the sink is not paced by an audio clock and accepts blocks as fast as they are rendered
+    virtual bool IsRealTime() const = 0;
+
+    // Blocks handed to the device that it has not played yet
+    virtual unsigned int QueuedBlocks() const { return 0; }
+
+    // Times the device ran out of audio since the sink was opened
+    virtual uint64_t Underruns() const { return 0; }
+
+    // Most blocks the device may hold at once, at most the block count given to Open. AcquireBlock waits while
+    // the limit is reached. Sinks that are not paced by an audio clock ignore it
+    virtual void SetQueueLimit(unsigned int) {}
+};
+
+// Discards everything, used to measure the render throughput
+class NullAudioSink : public IAudioSink {
+public:
+    bool Open(const AudioFormat &format, const unsigned int, const unsigned int blockSamples) override {
+        _format = format;
+        _blockSamples = blockSamples;
+        _block.assign(static_cast<size_t>(blockSamples) * format.BytesPerSample(), 0);
+        _framesWritten = 0;
+        return true;
+    }
+
+    void Close() override {
+    }
+
+    void *AcquireBlock() override { return _block.data(); }
+
+    void SubmitBlock() override { _framesWritten += _blockSamples / _format.Channels; }
+
+    bool IsRealTime() const override { return false; }
+
+    uint64_t FramesWritten() const { return _framesWritten; }
+
+private:
+    AudioFormat _format{};
+    unsigned int _blockSamples{};
+    std::vector<char> _block;
+    uint64_t _framesWritten{};
+};
+
+// Streams every block to a RIFF/WAVE file, the header sizes are patched when the sink is closed
+class WavFileAudioSink : public IAudioSink {
+public:
+    explicit WavFileAudioSink(std::string path) : _path(std::move(path)) {
+    }
+
+    ~WavFileAudioSink() override { Close(); }
+
+    bool Open(const AudioFormat &format, const unsigned int, const unsigned int blockSamples) override {
+        _format = format;
+        _block.assign(static_cast<size_t>(blockSamples) * format.BytesPerSample(), 0);
+        _dataBytes = 0;
+
+        _file.open(_path, std::ios::binary | std::ios::trunc);
+        if (!_file.is_open())
+            return false;
+
+        WriteHeader();
+        return _file.good();
+    }
+
+    void Close() override {
+        if (!_file.is_open())
+            return;
+
+        _file.seekp(0);
+        WriteHeader();
+        _file.close();
+    }
+
+    void *AcquireBlock() override { return _block.data(); }
+
+    void SubmitBlock() override { SubmitFrames(static_cast<unsigned int>(_block.size() / _format.BytesPerFrame())); }
+
+    // Writes only the first 'frames' frames of the block, for a stream that ends in the middle of one
+    void SubmitFrames(const unsigned int frames) {
+        const size_t bytes = std::min<size_t>(static_cast<size_t>(frames) * _format.BytesPerFrame(), _block.size());
+        _file.write(_block.data(), static_cast<std::streamsize>(bytes));
+        _dataBytes += bytes;
+    }
+
+    bool IsRealTime() const override { return false; }
+
+    uint64_t FramesWritten() const { return _dataBytes / _format.BytesPerFrame(); }
+
+private:
+    std::string _path;
+    std::ofstream _file;
+    AudioFormat _format{};
+    std::vector<char> _block;
+    uint64_t _dataBytes{};
+
+    // RIFF fields are little-endian
+    void WriteValue(const uint32_t value, const unsigned int bytes) {
+        for (unsigned int i = 0; i < bytes; i++)
+            _file.put(static_cast<char>(value >> (8 * i) & 0xFF));
+    }
+
+    void WriteHeader() {
+        // RIFF sizes are 32 bit, anything past 4GB is still written but the sizes saturate
+        const auto dataBytes = static_cast<uint32_t>(std::min<uint64_t>(_dataBytes, 0xFFFFFFFFu - 36));
+
+        _file.write("RIFF", 4);
+        WriteValue(36 + dataBytes, 4);
+        _file.write("WAVE", 4);
+
+        _file.write("fmt ", 4);
+        WriteValue(16, 4);
+        WriteValue(_format.IsFloat ? 3 : 1, 2); // WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_PCM
+        WriteValue(_format.Channels, 2);
+        WriteValue(_format.SampleRate, 4);
+        WriteValue(_format.SampleRate * _format.BytesPerFrame(), 4);
+        WriteValue(_format.BytesPerFrame(), 2);
+        WriteValue(_format.BitsPerSample, 2);
+
+        _file.write("data", 4);
+        WriteValue(dataBytes, 4);
+    }
+};
@@ -0,0 +1,120 @@
+/*
+	This file contains the audio engine telemetry: how long every block took to render, how much of the block
+	period was left (headroom), how many blocks the device had queued and how often it ran dry.
+	The render thread writes without locks or allocations, any other thread can read a summary at any time
+*/
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Statistics over the blocks currently inside the rolling window
+struct TelemetryStats {
+    double Min = 0.0;
+    double Average = 0.0;
+    double P99 = 0.0;
+    double Max = 0.0;
+};
+
+struct TelemetrySnapshot {
+    uint64_t Blocks = 0;
+    uint64_t Underruns = 0;
+    unsigned int WindowBlocks = 0;
+    TelemetryStats RenderMicros; // time spent rendering and converting a block
+    TelemetryStats HeadroomMicros; // block period minus render time, negative when the renderer is too slow
+    TelemetryStats QueueDepth; // blocks queued in the device when the block was started
+};
+
+class AudioTelemetry {
+public:
+    explicit AudioTelemetry(const unsigned int windowBlocks = 512) {
+        unsigned int size = 1;
+        while (size < windowBlocks)
+            size <<= 1;
+
+        _window = std::vector<BlockRecord>(size);
+        _mask = size - 1;
+    }
+
+    // Render thread only
+    void RecordBlock(const int64_t renderNanos, const int64_t periodNanos, const unsigned int queueDepth) {
+        const uint64_t block = _blocks.load(std::memory_order_relaxed);
+        BlockRecord &record = _window[block & _mask];
+        record.RenderNanos.store(static_cast<int32_t>(std::min<int64_t>(renderNanos, INT32_MAX)),
+                                 std::memory_order_relaxed);
+        record.HeadroomNanos.store(static_cast<int32_t>(std::max<int64_t>(periodNanos - renderNanos, INT32_MIN)),
+                                   std::memory_order_relaxed);
+        record.QueueDepth.store(queueDepth, std::memory_order_relaxed);
+        _blocks.store(block + 1, std::memory_order_release);
+    }
+
+    void RecordUnderruns(const uint64_t count) {
+        if (count > 0)
+            _underruns.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    uint64_t Blocks() const { return _blocks.load(std::memory_order_acquire); }
+
+    uint64_t Underruns() const { return _underruns.load(std::memory_order_relaxed); }
+
+    // Copies the window and summarizes it, the writer is never blocked. The record being written while this
+    // runs might be mixed from two blocks, which does not matter for the statistics
+    TelemetrySnapshot Read() const {
+        TelemetrySnapshot snapshot;
+        snapshot.Blocks = Blocks();
+        snapshot.Underruns = Underruns();
+        snapshot.WindowBlocks = static_cast<unsigned int>(std::min<uint64_t>(snapshot.Blocks, _mask + 1));
+
+        std::vector<double> render, headroom, queue;
+        render.reserve(snapshot.WindowBlocks);
+        headroom.reserve(snapshot.WindowBlocks);
+        queue.reserve(snapshot.WindowBlocks);
+
+        for (unsigned int n = 0; n < snapshot.WindowBlocks; n++) {
+            const BlockRecord &record = _window[(snapshot.Blocks - 1 - n) & _mask];
+            render.push_back(record.RenderNanos.load(std::memory_order_relaxed) / 1000.0);
+            headroom.push_back(record.HeadroomNanos.load(std::memory_order_relaxed) / 1000.0);
+            queue.push_back(record.QueueDepth.load(std::memory_order_relaxed));
+        }
+
+        snapshot.RenderMicros = Summarize(render, false);
+        // the tail that matters for the headroom is the smallest values
+        snapshot.HeadroomMicros = Summarize(headroom, true);
+        snapshot.QueueDepth = Summarize(queue, true);
+        return snapshot;
+    }
+
+private:
+    struct BlockRecord {
+        std::atomic<int32_t> RenderNanos{};
+        std::atomic<int32_t> HeadroomNanos{};
+        std::atomic<uint32_t> QueueDepth{};
+    };
+
+    std::vector<BlockRecord> _window;
+    uint64_t _mask{};
+    std::atomic<uint64_t> _blocks{};
+    std::atomic<uint64_t> _underruns{};
+
+    // P99 is the worst 1%, taken from the top of the values or from the bottom when lower is worse
+    static TelemetryStats Summarize(std::vector<double> &values, const bool lowIsWorse) {
+        TelemetryStats stats;
+        if (values.empty())
+            return stats;
+
+        std::sort(values.begin(), values.end());
+        stats.Min = values.front();
+        stats.Max = values.back();
+
+        double sum = 0.0;
+        for (const double value: values)
+            sum += value;
+        stats.Average = sum / static_cast<double>(values.size());
+
+        const auto tail = static_cast<size_t>(static_cast<double>(values.size() - 1) * 0.01 + 0.5);
+        stats.P99 = lowIsWorse ? values[tail] : values[values.size() - 1 - tail];
+        return stats;
+    }
+};
@@ -0,0 +1,352 @@
+/*
+	This file contains the block filters: the TPT state variable filter, the RBJ biquad and cascades of biquads.
+	They process a whole buffer per call without virtual calls, and a new cutoff or Q does not jump, the
+	coefficients move to the new ones in a straight line over the next frames.
+	The state variable filter stays stable while its cutoff moves, so it is the one to modulate. Many of them can
+	run side by side in SIMD lanes, one per voice or per bus
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "LaneVector.h"
+#include "SynthUtils.h"
+
+namespace synth {
+    constexpr int FILTER_LOW_PASS = 0;
+    constexpr int FILTER_HIGH_PASS = 1;
+    constexpr int FILTER_BAND_PASS = 2;
+    constexpr int FILTER_NOTCH = 3;
+    constexpr int FILTER_PEAK = 4; // biquads boost or cut around the cutoff, the state variable filter resonates
+
+    // Filter type from its name (lowpass, highpass, bandpass, notch or peak), -1 if there is no such type
+    inline int ParseFilterType(const std::string &name) {
+        static const char *names[] = {"lowpass", "highpass", "bandpass", "notch", "peak"};
+        for (int type = 0; type <= FILTER_PEAK; type++)
+            if (name == names[type])
+                return type;
+        return -1;
+    }
+
+    // Coefficients that move to new ones in a straight line, one step per sample. The first ones set are taken
+    // on the spot
+    template<unsigned int N>
+    struct CoefficientRamp {
+        float Current[N]{};
+
+        void SetTarget(const float *target, const unsigned int frames) {
+            if (!_isSet || frames == 0) {
+                std::copy(target, target + N, Current);
+                _remaining = 0;
+                _isSet = true;
+                return;
+            }
+            for (unsigned int i = 0; i < N; i++) {
+                _target[i] = target[i];
+                _step[i] = (target[i] - Current[i]) / static_cast<float>(frames);
+            }
+            _remaining = frames;
+        }
+
+        bool IsRamping() const { return _remaining > 0; }
+
+        // Moves one sample along the ramp, the last step lands on the target exactly
+        void Advance() {
+            if (_remaining == 0)
+                return;
+            if (--_remaining == 0)
+                std::copy(_target, _target + N, Current);
+            else
+                for (unsigned int i = 0; i < N; i++)
+                    Current[i] += _step[i];
+        }
+
+    private:
+        float _target[N]{};
+        float _step[N]{};
+        unsigned int _remaining = 0;
+        bool _isSet = false;
+    };
+
+    // Filter state smaller than this is cleared after every block. A filter fed silence would otherwise decay into
+    // denormal floats, which are many times slower to work with
+    constexpr float FILTER_STATE_FLOOR = 1e-15f;
+
+    inline float FlushState(const float state) {
+        return std::fabs(state) < FILTER_STATE_FLOOR ? 0.0f : state;
+    }
+
+    constexpr unsigned int SVF_COEFFICIENTS = 6;
+
+    // a1, a2 and a3 run the two integrators, m0, m1 and m2 mix the input, band pass and low pass into the output
+    inline void StateVariableCoefficients(const int type, const double cutoff, const double q,
+                                          const double sampleRate, float *coefficients) {
+        const double g = std::tan(PI * std::min(cutoff, sampleRate * 0.49) / sampleRate);
+        const double k = 1.0 / std::max(q, 0.01);
+        const double a1 = 1.0 / (1.0 + g * (g + k));
+        const double a2 = g * a1;
+        const double a3 = g * a2;
+
+        double m0 = 0.0, m1 = 0.0, m2 = 1.0;
+        if (type == FILTER_HIGH_PASS) {
+            m0 = 1.0;
+            m1 = -k;
+            m2 = -1.0;
+        } else if (type == FILTER_BAND_PASS) {
+            m1 = k; // unity gain at the cutoff
+            m2 = 0.0;
+        } else if (type == FILTER_NOTCH) {
+            m0 = 1.0;
+            m1 = -k;
+            m2 = 0.0;
+        } else if (type == FILTER_PEAK) {
+            m0 = 1.0;
+            m1 = -k;
+            m2 = -2.0;
+        }
+
+        const double values[SVF_COEFFICIENTS] = {a1, a2, a3, m0, m1, m2};
+        for (unsigned int i = 0; i < SVF_COEFFICIENTS; i++)
+            coefficients[i] = static_cast<float>(values[i]);
+    }
+
+    // Topology preserving transform state variable filter, 12 dB per octave
+    class StateVariableFilter {
+    public:
+        // The filter gets to the new settings after 'rampFrames', 0 sets them on the spot
+        void SetParameters(const int type, const double cutoff, const double q, const double sampleRate,
+                           const unsigned int rampFrames = 0) {
+            float coefficients[SVF_COEFFICIENTS];
+            StateVariableCoefficients(type, cutoff, q, sampleRate, coefficients);
+            _coefficients.SetTarget(coefficients, rampFrames);
+        }
+
+        void Reset() { _ic1 = _ic2 = 0.0f; }
+
+        // Filters 'frames' samples in place
+        void Process(float *samples, const unsigned int frames) {
+            float ic1 = _ic1, ic2 = _ic2;
+            const float *c = _coefficients.Current;
+            for (unsigned int n = 0; n < frames; n++) {
+                const float v0 = samples[n];
+                const float v3 = v0 - ic2;
+                const float v1 = c[0] * ic1 + c[1] * v3;
+                const float v2 = ic2 + c[1] * ic1 + c[2] * v3;
+                ic1 = 2.0f * v1 - ic1;
+                ic2 = 2.0f * v2 - ic2;
+                samples[n] = c[3] * v0 + c[4] * v1 + c[5] * v2;
+                _coefficients.Advance();
+            }
+            _ic1 = FlushState(ic1);
+            _ic2 = FlushState(ic2);
+        }
+
+    private:
+        CoefficientRamp<SVF_COEFFICIENTS> _coefficients;
+        float _ic1 = 0.0f;
+        float _ic2 = 0.0f;
+    };
+
+    constexpr unsigned int BIQUAD_COEFFICIENTS = 5;
+
+    // b0, b1, b2, a1 and a2 of the cookbook filters, already divided by a0. 'gainDb' is only used by the peak
+    inline void BiquadCoefficients(const int type, const double cutoff, const double q, const double gainDb,
+                                   const double sampleRate, float *coefficients) {
+        const double w0 = 2.0 * PI * std::min(cutoff, sampleRate * 0.49) / sampleRate;
+        const double cosW0 = std::cos(w0);
+        const double alpha = std::sin(w0) / (2.0 * std::max(q, 0.01));
+        const double a = std::pow(10.0, gainDb / 40.0);
+
+        double b0, b1, b2, a0, a1 = -2.0 * cosW0, a2;
+        if (type == FILTER_HIGH_PASS) {
+            b0 = b2 = (1.0 + cosW0) / 2.0;
+            b1 = -(1.0 + cosW0);
+            a0 = 1.0 + alpha;
+            a2 = 1.0 - alpha;
+        } else if (type == FILTER_BAND_PASS) {
+            b0 = alpha;
+            b1 = 0.0;
+            b2 = -alpha;
+            a0 = 1.0 + alpha;
+            a2 = 1.0 - alpha;
+        } else if (type == FILTER_NOTCH) {
+            b0 = b2 = 1.0;
+            b1 = -2.0 * cosW0;
+            a0 = 1.0 + alpha;
+            a2 = 1.0 - alpha;
+        } else if (type == FILTER_PEAK) {
+            b0 = 1.0 + alpha * a;
+            b1 = -2.0 * cosW0;
+            b2 = 1.0 - alpha * a;
+            a0 = 1.0 + alpha / a;
+            a2 = 1.0 - alpha / a;
+        } else {
+            b0 = b2 = (1.0 - cosW0) / 2.0;
+            b1 = 1.0 - cosW0;
+            a0 = 1.0 + alpha;
+            a2 = 1.0 - alpha;
+        }
+
+        const double values[BIQUAD_COEFFICIENTS] = {b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0};
+        for (unsigned int i = 0; i < BIQUAD_COEFFICIENTS; i++)
+            coefficients[i] = static_cast<float>(values[i]);
+    }
+
+    // RBJ cookbook biquad in transposed direct form II. Keep the ramps short when the cutoff moves a lot, the
+    // coefficients in between are not always a stable filter
+    class Biquad {
+    public:
+        void SetParameters(const int type, const double cutoff, const double q, const double sampleRate,
+                           const unsigned int rampFrames = 0, const double gainDb = 0.0) {
+            float coefficients[BIQUAD_COEFFICIENTS];
+            BiquadCoefficients(type, cutoff, q, gainDb, sampleRate, coefficients);
+            _coefficients.SetTarget(coefficients, rampFrames);
+        }
+
+        void Reset() { _z1 = _z2 = 0.0f; }
+
+        void Process(float *samples, const unsigned int frames) {
+            float z1 = _z1, z2 = _z2;
+            const float *c = _coefficients.Current;
+            for (unsigned int n = 0; n < frames; n++) {
+                const float x = samples[n];
+                const float y = c[0] * x + z1;
+                z1 = c[1] * x - c[3] * y + z2;
+                z2 = c[2] * x - c[4] * y;
+                samples[n] = y;
+                _coefficients.Advance();
+            }
+            _z1 = FlushState(z1);
+            _z2 = FlushState(z2);
+        }
+
+    private:
+        CoefficientRamp<BIQUAD_COEFFICIENTS> _coefficients;
+        float _z1 = 0.0f;
+        float _z2 = 0.0f;
+    };
+
+    // N biquads one after the other, 12 dB per octave each. SetButterworth spreads the Qs so the sections add up
+    // to a Butterworth filter of order 2N
+    template<unsigned int N>
+    class BiquadCascade {
+    public:
+        Biquad Sections[N];
+
+        void SetButterworth(const int type, const double cutoff, const double sampleRate,
+                            const unsigned int rampFrames = 0) {
+            for (unsigned int k = 0; k < N; k++) {
+                const double q = 1.0 / (2.0 * std::cos(PI * (2.0 * k + 1.0) / (4.0 * N)));
+                Sections[k].SetParameters(type, cutoff, q, sampleRate, rampFrames);
+            }
+        }
+
+        void Reset() {
+            for (Biquad &section: Sections)
+                section.Reset();
+        }
+
+        void Process(float *samples, const unsigned int frames) {
+            for (Biquad &section: Sections)
+                section.Process(samples, frames);
+        }
+    };
+
+    // Independent state variable filters run side by side, LaneVector::WIDTH of them per instruction. The samples
+    // of all the lanes are interleaved, frame n of lane l is at n * LaneCount() + l. New settings are reached over
+    // the next Process call
+    class StateVariableFilterLanes {
+    public:
+        explicit StateVariableFilterLanes(const unsigned int lanes)
+            : _laneCount((lanes + LaneVector::WIDTH - 1) / LaneVector::WIDTH * LaneVector::WIDTH),
+              _coefficients(SVF_COEFFICIENTS * _laneCount), _targets(SVF_COEFFICIENTS * _laneCount),
+              _ic1(_laneCount), _ic2(_laneCount) {
+        }
+
+        // Lanes the interleaved buffers need, a multiple of the vector width
+        unsigned int LaneCount() const { return _laneCount; }
+
+        void SetParameters(const unsigned int lane, const int type, const double cutoff, const double q,
+                           const double sampleRate) {
+            float coefficients[SVF_COEFFICIENTS];
+            StateVariableCoefficients(type, cutoff, q, sampleRate, coefficients);
+            // a1 is never 0 once a lane is set, a lane set for the first time starts on its coefficients
+            const bool isSet = _coefficients[lane] != 0.0f;
+            for (unsigned int i = 0; i < SVF_COEFFICIENTS; i++) {
+                _targets[i * _laneCount + lane] = coefficients[i];
+                if (!isSet)
+                    _coefficients[i * _laneCount + lane] = coefficients[i];
+            }
+            _isRamping = true;
+        }
+
+        void Reset(const unsigned int lane) { _ic1[lane] = _ic2[lane] = 0.0f; }
+
+        // The two integrators of a lane. Filters that take turns on the lanes keep them between Process calls
+        void GetState(const unsigned int lane, float *state) const {
+            state[0] = _ic1[lane];
+            state[1] = _ic2[lane];
+        }
+
+        void SetState(const unsigned int lane, const float *state) {
+            _ic1[lane] = state[0];
+            _ic2[lane] = state[1];
+        }
+
+        void Process(float *samples, const unsigned int frames) {
+            if (frames == 0)
+                return;
+
+            constexpr unsigned int W = LaneVector::WIDTH;
+            const LaneVector two = LaneVector::Set(2.0f);
+            const LaneVector steps = LaneVector::Set(_isRamping ? 1.0f / static_cast<float>(frames) : 0.0f);
+
+            for (unsigned int l = 0; l < _laneCount; l += W) {
+                LaneVector c[SVF_COEFFICIENTS], step[SVF_COEFFICIENTS];
+                for (unsigned int i = 0; i < SVF_COEFFICIENTS; i++) {
+                    c[i] = LaneVector::Load(&_coefficients[i * _laneCount + l]);
+                    step[i] = (LaneVector::Load(&_targets[i * _laneCount + l]) - c[i]) * steps;
+                }
+                LaneVector ic1 = LaneVector::Load(&_ic1[l]);
+                LaneVector ic2 = LaneVector::Load(&_ic2[l]);
+
+                float *frame = samples + l;
+                for (unsigned int n = 0; n < frames; n++, frame += _laneCount) {
+                    const LaneVector v0 = LaneVector::Load(frame);
+                    const LaneVector v3 = v0 - ic2;
+                    const LaneVector v1 = c[0] * ic1 + c[1] * v3;
+                    const LaneVector v2 = ic2 + c[1] * ic1 + c[2] * v3;
+                    ic1 = two * v1 - ic1;
+                    ic2 = two * v2 - ic2;
+                    (c[3] * v0 + c[4] * v1 + c[5] * v2).Store(frame);
+                    for (unsigned int i = 0; i < SVF_COEFFICIENTS; i++)
+                        c[i] = c[i] + step[i];
+                }
+
+                ic1.Store(&_ic1[l]);
+                ic2.Store(&_ic2[l]);
+            }
+
+            for (unsigned int l = 0; l < _laneCount; l++) {
+                _ic1[l] = FlushState(_ic1[l]);
+                _ic2[l] = FlushState(_ic2[l]);
+            }
+
+            // the ramps end on the targets, the sum of the steps is only close to them
+            if (_isRamping)
+                _coefficients = _targets;
+            _isRamping = false;
+        }
+
+    private:
+        unsigned int _laneCount;
+        // coefficient i of lane l is at i * _laneCount + l, so a group of lanes loads at once
+        std::vector<float> _coefficients;
+        std::vector<float> _targets;
+        std::vector<float> _ic1;
+        std::vector<float> _ic2;
+        bool _isRamping = false;
+    };
+}
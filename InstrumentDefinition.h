@@ -0,0 +1,625 @@
+/*
+	This file contains the additive instruments, described as data instead of code.
+	A description lists the partials of the instrument (pitch, weight, wave form and modulation) and its envelope,
+	it is read once at startup and turned into a flat partial table that every note is built from.
+
+	instrument <name>
+	volume <volume>
+	pan <pan>
+	fm <amplitude> <hertz>
+	am <amplitude> <hertz>
+	adsr <attack> <decay> <sustain> <release> [start amplitude]
+	lifetime <seconds> | envelope           (envelope is the attack plus the decay of the adsr line above it)
+	maxvoices <notes>                       (notes held at once, 0 for no limit)
+	bus <drums|chords|bass|user>            (mixer bus the notes are played on, user when it is left out)
+	oneshot                                 (every note is rendered once at startup and played back from memory,
+	                                         needs a lifetime. Its noise is the same on every hit)
+	remap <note>=<note> ...                 (notes replaced before the partials are worked out)
+	filter <type> <hertz> [q]               (state variable filter on every note, lowpass, highpass, bandpass, notch
+	                                         or peak. Q is 0.7071 when it is left out)
+	partial <weight> [key=value ...] [fm] [am]  (up to 8 per instrument)
+
+	The keys of a partial are note=<semitones from the played note>, times=<multiple of that frequency>,
+	fixed=<scale position played whatever the note is>, negative=<semitones added before the negative harmony
+	transform> and wave=<sine|square|triangle|saw-analog|saw-digital|noise|square-blep|triangle-blep|saw-blep>.
+	Anything after a '#' is a comment
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Filters.h"
+#include "SynthUtils.h"
+
+namespace synth {
+    struct PartialDefinition {
+        double Weight = 1.0;
+        int Note = 0; // semitones from the played note, or from the transformed one
+        double Multiple = 1.0; // the frequency is multiplied by it
+        int Type = OSC_SINE;
+        bool UseFM = false;
+        bool UseAM = false;
+        bool IsFixed = false; // 'Note' is a scale position, the played note is ignored
+        bool IsNegative = false; // the played note plus 'NegativeOffset' goes through the negative harmony transform
+        int NegativeOffset = 0;
+    };
+
+    struct InstrumentDefinition {
+        std::string Name;
+        double Volume = 1.0;
+        double Pan = 0.0;
+        EnvolopeADSR Env;
+        LFO FM{0.0, 0.0};
+        LFO AM{0.0, 0.0};
+        double MaxLifeTime = -1.0;
+        unsigned int MaxVoices = 0;
+        int Bus = BUS_USER;
+        bool IsOneShot = false;
+        int FilterType = -1; // no voice filter
+        double FilterCutoff = 1000.0;
+        double FilterQ = 0.7071;
+        std::vector<std::pair<int, int> > Remap;
+        std::vector<PartialDefinition> Partials;
+    };
+
+    constexpr unsigned int VOICE_FILTER_LANES = 8; // voices of an instrument filtered side by side
+
+    struct AdditiveInstrument;
+
+    // Notes rendered ahead of time that an instrument can play back instead of synthesizing them, it is only asked
+    // from the render thread when a note starts
+    struct VoiceCache {
+        virtual ~VoiceCache() = default;
+
+        // False when the note is not rendered yet, 'note' is the key the instrument gives it
+        virtual bool Find(const AdditiveInstrument *instrument, int note, const float *&samples,
+                          unsigned int &length) = 0;
+    };
+
+    // Instrument played from a definition, its partials are kept in a fixed table so a note never allocates
+    struct AdditiveInstrument : public InstrumentBase {
+        VoiceCache *Cache = nullptr; // asked for the notes of instruments with a life time that are not one-shots
+
+        AdditiveInstrument() = default;
+
+        explicit AdditiveInstrument(const InstrumentDefinition &definition) {
+            Load(definition);
+        }
+
+        void Load(const InstrumentDefinition &definition) {
+            Volume = definition.Volume;
+            Pan = definition.Pan;
+            Env = definition.Env;
+            FM = definition.FM;
+            AM = definition.AM;
+            MaxLifeTime = definition.MaxLifeTime;
+            MaxVoices = definition.MaxVoices;
+            Bus = definition.Bus;
+            NoiseSeed = NameSeed(definition.Name);
+            HasVoiceFilter = definition.FilterType >= 0;
+            _filterType = definition.FilterType;
+            _filterCutoff = definition.FilterCutoff;
+            _filterQ = definition.FilterQ;
+            _filterSampleRate = 0.0;
+            _filterLanes = StateVariableFilterLanes(HasVoiceFilter ? VOICE_FILTER_LANES : 0);
+            _filterBlock.assign(static_cast<size_t>(VOICE_BLOCK_FRAMES) * _filterLanes.LaneCount(), 0.0f);
+
+            _remap = definition.Remap;
+            _isOneShot = definition.IsOneShot && definition.MaxLifeTime > 0.0;
+            _oneShots.clear();
+
+            // the library never loads more than MAX_PARTIALS
+            _partialCount = 0;
+            for (const PartialDefinition &partial: definition.Partials)
+                if (_partialCount < MAX_PARTIALS)
+                    _partials[_partialCount++] = partial;
+        }
+
+        void NoteOn(VoiceState &voice, const int &scalePos) override {
+            const int note = Remap(scalePos);
+            if (!_oneShots.empty()) {
+                const auto oneShot = _oneShots.find(NoteKey(note));
+                if (oneShot != _oneShots.end()) {
+                    voice.PlayOneShot(oneShot->second.data(), static_cast<unsigned int>(oneShot->second.size()));
+                    return;
+                }
+            }
+
+            const float *samples;
+            unsigned int length;
+            if (Cache != nullptr && MaxLifeTime > 0.0 && Cache->Find(this, NoteKey(note), samples, length)) {
+                voice.PlayOneShot(samples, length);
+                return;
+            }
+            AddPartials(voice, note);
+        }
+
+        // Renders the whole life of a note into 'samples', before the envelope. 'note' is a key from NoteKey
+        void RenderNote(const double &sampleRate, const int note, std::vector<float> &samples) const {
+            // the noise seed of a note of this instrument played on the first frame
+            VoiceState voice;
+            voice.Start(sampleRate, FM, AM, NoiseSeed ^ static_cast<uint64_t>(note + 1024));
+            AddPartials(voice, note);
+
+            const auto frames = static_cast<unsigned int>(std::ceil(std::max(MaxLifeTime, 0.0) * sampleRate));
+            samples.resize(frames);
+            for (unsigned int n = 0; n < frames; n += VOICE_BLOCK_FRAMES)
+                voice.Render(samples.data() + n, std::min(VOICE_BLOCK_FRAMES, frames - n));
+        }
+
+        // Renders the whole life of each of 'notes' once, so they are played back from memory instead of being
+        // synthesized. Only for one-shot instruments, notes that were not rendered are still synthesized
+        void PrepareOneShots(const double &sampleRate, const std::vector<int> &notes) {
+            _oneShots.clear();
+            if (!_isOneShot)
+                return;
+
+            for (const int scalePos: notes) {
+                const int note = NoteKey(Remap(scalePos));
+                if (_oneShots.find(note) == _oneShots.end())
+                    RenderNote(sampleRate, note, _oneShots[note]);
+            }
+        }
+
+        // The voices are rendered a block at a time, with no virtual call per sample. With a voice filter they
+        // are filtered side by side, a group of lanes at a time, and each voice keeps its own filter state
+        void RenderBlock(const VoiceSpan &voices, float *left, float *right, const unsigned int frames) override {
+            float block[VOICE_BLOCK_FRAMES];
+            if (!HasVoiceFilter || voices.Count == 0) {
+                for (unsigned int v = 0; v < voices.Count; v++) {
+                    voices.Voices[v].Voice->Render(block, frames);
+                    MixVoice(voices.Voices[v], block, 1, left, right, frames);
+                }
+                return;
+            }
+
+            const unsigned int lanes = _filterLanes.LaneCount();
+            const double sampleRate = voices.Voices[0].Voice->SampleRate;
+            if (sampleRate != _filterSampleRate) {
+                for (unsigned int l = 0; l < lanes; l++)
+                    _filterLanes.SetParameters(l, _filterType, _filterCutoff, _filterQ, sampleRate);
+                _filterSampleRate = sampleRate;
+            }
+
+            for (unsigned int first = 0; first < voices.Count; first += lanes) {
+                const unsigned int count = std::min(lanes, voices.Count - first);
+                for (unsigned int l = 0; l < lanes; l++) {
+                    if (l < count) {
+                        VoiceState &voice = *voices.Voices[first + l].Voice;
+                        voice.Render(block, frames);
+                        _filterLanes.SetState(l, voice.FilterState);
+                    } else {
+                        std::fill(block, block + frames, 0.0f);
+                        _filterLanes.Reset(l);
+                    }
+                    for (unsigned int n = 0; n < frames; n++)
+                        _filterBlock[n * lanes + l] = block[n];
+                }
+
+                _filterLanes.Process(_filterBlock.data(), frames);
+                for (unsigned int l = 0; l < count; l++) {
+                    _filterLanes.GetState(l, voices.Voices[first + l].Voice->FilterState);
+                    MixVoice(voices.Voices[first + l], _filterBlock.data() + l, lanes, left, right, frames);
+                }
+            }
+        }
+
+    private:
+        PartialDefinition _partials[MAX_PARTIALS];
+        unsigned int _partialCount = 0;
+        std::vector<std::pair<int, int> > _remap;
+        bool _isOneShot = false;
+        std::map<int, std::vector<float> > _oneShots; // samples of each note, by NoteKey
+        int _filterType = -1;
+        double _filterCutoff = 1000.0;
+        double _filterQ = 0.7071;
+        double _filterSampleRate = 0.0; // the lanes are set up for it on the first block
+        StateVariableFilterLanes _filterLanes{0};
+        std::vector<float> _filterBlock; // frame n of lane l is at n * lanes + l
+
+        // Adds the samples of a voice, one every 'stride' floats, with its gains ramped over the block
+        static void MixVoice(const BlockVoice &voice, const float *samples, const unsigned int stride, float *left,
+                             float *right, const unsigned int frames) {
+            const auto gainLeft = static_cast<float>(voice.Gain0[0]);
+            const auto stepLeft = static_cast<float>((voice.Gain1[0] - voice.Gain0[0]) / frames);
+            for (unsigned int n = 0; n < frames; n++)
+                left[n] += samples[n * stride] * (gainLeft + stepLeft * static_cast<float>(n));
+
+            if (right != nullptr) {
+                const auto gainRight = static_cast<float>(voice.Gain0[1]);
+                const auto stepRight = static_cast<float>((voice.Gain1[1] - voice.Gain0[1]) / frames);
+                for (unsigned int n = 0; n < frames; n++)
+                    right[n] += samples[n * stride] * (gainRight + stepRight * static_cast<float>(n));
+            }
+        }
+
+        // FNV-1a hash of the name, the noise of an instrument stays the same from run to run
+        static uint64_t NameSeed(const std::string &name) {
+            uint64_t hash = 0xCBF29CE484222325ull;
+            for (const char c: name)
+                hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+            return hash;
+        }
+
+        int Remap(const int scalePos) const {
+            for (const auto &remap: _remap)
+                if (remap.first == scalePos)
+                    return remap.second;
+            return scalePos;
+        }
+
+        // Notes sound the same when every partial is fixed, they share a single rendered note then
+        int NoteKey(const int note) const {
+            for (unsigned int n = 0; n < _partialCount; n++)
+                if (!_partials[n].IsFixed)
+                    return note;
+            return 0;
+        }
+
+        void AddPartials(VoiceState &voice, const int note) const {
+            for (unsigned int n = 0; n < _partialCount; n++) {
+                const PartialDefinition &partial = _partials[n];
+                int position = partial.Note;
+                if (partial.IsNegative)
+                    position += NegativeHarmonyTransformation(note + partial.NegativeOffset);
+                else if (!partial.IsFixed)
+                    position += note;
+
+                voice.AddPartial(partial.Weight, partial.Multiple * ScaleToFrequency(position), partial.Type,
+                                 partial.UseFM, partial.UseAM);
+            }
+        }
+    };
+
+    // Wave form from its name in a definition, -1 if there is no such wave form
+    inline int ParseWaveform(const std::string &name) {
+        static const std::pair<const char *, int> names[] = {
+            {"sine", OSC_SINE}, {"square", OSC_SQUARE}, {"triangle", OSC_TRIANGLE},
+            {"saw-analog", OSC_SAW_ANALOG}, {"saw-digital", OSC_SAW_DIGITAL}, {"noise", OSC_NOISE},
+            {"square-blep", OSC_SQUARE_BLEP}, {"triangle-blep", OSC_TRIANGLE_BLEP}, {"saw-blep", OSC_SAW_BLEP}
+        };
+        for (const auto &entry: names)
+            if (name == entry.first)
+                return entry.second;
+        return -1;
+    }
+
+    // All the instruments known by name. A description read later replaces the instrument with the same name
+    // in place, so pointers to it stay valid
+    class InstrumentLibrary {
+    public:
+        // Returns false and describes the problem in 'error' when a line can not be read, none of the instruments
+        // in the stream are used then
+        bool Load(std::istream &stream, std::string &error) {
+            std::vector<InstrumentDefinition> definitions;
+            std::string line;
+            unsigned int lineNumber = 0;
+
+            while (std::getline(stream, line)) {
+                lineNumber++;
+                if (line.find('#') != std::string::npos)
+                    line.erase(line.find('#'));
+
+                std::stringstream words(line);
+                std::string keyword;
+                if (!(words >> keyword))
+                    continue;
+
+                if (keyword == "instrument") {
+                    definitions.emplace_back();
+                    if (!(words >> definitions.back().Name))
+                        return Fail(error, lineNumber, "instrument without a name");
+                    continue;
+                }
+                if (definitions.empty())
+                    return Fail(error, lineNumber, "\"" + keyword + "\" before the first instrument");
+                if (keyword == "partial" && definitions.back().Partials.size() == MAX_PARTIALS)
+                    return Fail(error, lineNumber, "more than " + std::to_string(MAX_PARTIALS) + " partials");
+                if (!ParseLine(keyword, words, definitions.back()))
+                    return Fail(error, lineNumber, "could not read \"" + line + "\"");
+            }
+
+            for (const InstrumentDefinition &definition: definitions)
+                _instruments[definition.Name].Load(definition);
+            return true;
+        }
+
+        bool Load(const std::string &text, std::string &error) {
+            std::stringstream stream(text);
+            return Load(stream, error);
+        }
+
+        // Renders the one-shots of every instrument for 'notes', called again after loading more instruments
+        void PrepareOneShots(const double &sampleRate, const std::vector<int> &notes) {
+            for (auto &instrument: _instruments)
+                instrument.second.PrepareOneShots(sampleRate, notes);
+        }
+
+        // Cache every instrument asks for its notes, nullptr for none
+        void SetCache(VoiceCache *cache) {
+            for (auto &instrument: _instruments)
+                instrument.second.Cache = cache;
+        }
+
+        // nullptr when there is no instrument with that name
+        AdditiveInstrument *Find(const std::string &name) {
+            const auto instrument = _instruments.find(name);
+            return instrument != _instruments.end() ? &instrument->second : nullptr;
+        }
+
+    private:
+        std::map<std::string, AdditiveInstrument> _instruments;
+
+        static bool Fail(std::string &error, const unsigned int lineNumber, const std::string &message) {
+            error = "line " + std::to_string(lineNumber) + ": " + message;
+            return false;
+        }
+
+        static bool ParseLine(const std::string &keyword, std::stringstream &words, InstrumentDefinition &definition) {
+            if (keyword == "volume")
+                return static_cast<bool>(words >> definition.Volume);
+            if (keyword == "pan")
+                return static_cast<bool>(words >> definition.Pan);
+            if (keyword == "fm")
+                return static_cast<bool>(words >> definition.FM.Amplitude >> definition.FM.Hertz);
+            if (keyword == "am")
+                return static_cast<bool>(words >> definition.AM.Amplitude >> definition.AM.Hertz);
+            if (keyword == "adsr") {
+                EnvolopeADSR &env = definition.Env;
+                if (!(words >> env.AttackTime >> env.DecayTime >> env.SustainAmplitude >> env.ReleaseTime))
+                    return false;
+                words >> env.StartAmplitude;
+                return true;
+            }
+            if (keyword == "lifetime") {
+                std::string value;
+                if (!(words >> value))
+                    return false;
+                if (value == "envelope") {
+                    definition.MaxLifeTime = definition.Env.AttackTime + definition.Env.DecayTime;
+                    return true;
+                }
+                std::stringstream number(value);
+                return static_cast<bool>(number >> definition.MaxLifeTime);
+            }
+            if (keyword == "maxvoices")
+                return static_cast<bool>(words >> definition.MaxVoices);
+            if (keyword == "oneshot") {
+                definition.IsOneShot = true;
+                return true;
+            }
+            if (keyword == "bus") {
+                std::string name;
+                if (!(words >> name))
+                    return false;
+                definition.Bus = ParseBus(name);
+                return definition.Bus >= 0;
+            }
+            if (keyword == "filter") {
+                std::string type;
+                if (!(words >> type >> definition.FilterCutoff))
+                    return false;
+                definition.FilterType = ParseFilterType(type);
+                words >> definition.FilterQ;
+                return definition.FilterType >= 0 && definition.FilterCutoff > 0.0 && definition.FilterQ > 0.0;
+            }
+            if (keyword == "remap") {
+                std::string pair;
+                while (words >> pair) {
+                    int from, to;
+                    char equals;
+                    std::stringstream values(pair);
+                    if (!(values >> from >> equals >> to) || equals != '=')
+                        return false;
+                    definition.Remap.emplace_back(from, to);
+                }
+                return true;
+            }
+            if (keyword == "partial") {
+                PartialDefinition partial;
+                if (!(words >> partial.Weight))
+                    return false;
+
+                std::string field;
+                while (words >> field) {
+                    const size_t equals = field.find('=');
+                    const std::string key = field.substr(0, equals);
+                    const std::string value = equals == std::string::npos ? "" : field.substr(equals + 1);
+                    std::stringstream number(value);
+
+                    if (key == "fm")
+                        partial.UseFM = true;
+                    else if (key == "am")
+                        partial.UseAM = true;
+                    else if (key == "wave")
+                        partial.Type = ParseWaveform(value);
+                    else if (key == "note" && number >> partial.Note)
+                        continue;
+                    else if (key == "times" && number >> partial.Multiple)
+                        continue;
+                    else if (key == "fixed" && number >> partial.Note)
+                        partial.IsFixed = true;
+                    else if (key == "negative" && number >> partial.NegativeOffset)
+                        partial.IsNegative = true;
+                    else
+                        return false;
+
+                    if (partial.Type < 0)
+                        return false;
+                }
+                definition.Partials.push_back(partial);
+                return true;
+            }
+            return false;
+        }
+    };
+
+    // The instruments Muve ships with, a file given with "--instruments" can replace them or add new ones
+    constexpr const char *BUILT_IN_INSTRUMENTS = R"(
+# meant to be played by the user
+instrument standard
+volume 0.6
+fm 1.5 1.5
+am 0.3 3.0
+adsr 0.01 0.1 0.65 0.1
+partial 2.0 note=-24 fm am
+partial 0.5 note=24 fm am
+partial 0.5 note=0 fm am
+
+instrument bell
+volume 0.7
+fm 5.0 0.001
+adsr 0.01 1.0 0.0 1.0
+partial 1.0 note=12 fm
+partial 0.5 note=24
+partial 0.25 note=36
+
+instrument bell8
+volume 0.35
+fm 5.0 0.001
+adsr 0.01 0.5 0.8 1.0
+partial 1.0 wave=square-blep fm
+partial 0.5 note=12
+partial 0.25 note=24
+
+instrument harmonica
+volume 0.22
+fm 5.0 0.001
+adsr 0.05 1.0 0.95 0.1
+partial 1.0 note=-12 wave=saw-blep fm
+partial 1.0 wave=square-blep fm
+partial 0.5 note=12 wave=square-blep
+partial 0.25 fixed=0 wave=noise
+
+# meant to be played by the sequencer
+instrument kick
+volume 1.0
+bus drums
+adsr 0.001 0.5 0.0 0.0
+lifetime envelope
+oneshot
+partial 1.0 fixed=-33 fm am
+partial 0.8 fixed=-33 times=2 fm am
+partial 0.01 fixed=0 wave=noise
+
+instrument snare
+volume 0.15
+fm 0.5 1.0
+bus drums
+adsr 0.01 0.6 0.0 0.0
+lifetime envelope
+oneshot
+partial 0.5 note=-24 fm
+partial 0.5 fixed=0 wave=noise
+
+instrument hihat
+volume 0.1
+fm 1.5 1.0
+bus drums
+adsr 0.01 0.05 0.0 0.0
+lifetime envelope
+oneshot
+partial 0.1 note=-12 wave=square-blep fm
+partial 0.9 fixed=0 wave=noise
+
+instrument user-sensor
+volume 1.3
+fm 1.5 1.5
+am 0.3 3.0
+adsr 0.01 0.5 0.0 0.0
+lifetime envelope
+partial 1.0 note=-24 fm am
+partial 0.5 note=24 fm am
+partial 0.5 fm am
+
+instrument user-sensor-inversion
+volume 1.3
+fm 1.5 1.5
+am 0.3 3.0
+adsr 0.01 0.5 0.0 0.0
+lifetime envelope
+partial 1.0 negative=0 note=-24 fm am
+partial 0.5 negative=0 note=24 fm am
+partial 0.5 negative=0 fm am
+
+instrument user-sensor-diminished
+volume 1.3
+fm 1.5 1.5
+am 0.3 3.0
+adsr 0.01 0.5 0.0 0.0
+lifetime envelope
+remap 7=6 8=7 10=9
+partial 1.0 negative=0 note=-24 fm am
+partial 0.5 negative=0 note=24 fm am
+partial 0.5 negative=0 fm am
+
+instrument cord-player
+volume 0.5
+fm 1.0 1.0
+am 0.5 4.0
+bus chords
+adsr 0.01 1.1 0.0 0.0
+lifetime envelope
+filter lowpass 1200
+partial 1.0 note=-12 fm
+partial 1.0 note=-5 fm
+partial 1.0 note=0 fm
+partial 1.0 note=3 fm
+partial 1.0 note=7 fm
+
+instrument cord-diminished
+volume 0.5
+fm 1.0 1.0
+am 0.5 4.0
+bus chords
+adsr 0.01 1.1 0.0 0.0
+lifetime envelope
+filter lowpass 1200
+partial 1.0 note=-12 fm
+partial 1.0 note=-6 fm
+partial 1.0 note=0 fm
+partial 1.0 note=3 fm
+partial 1.0 note=6 fm
+
+instrument cord-inversion
+volume 0.5
+fm 1.0 1.0
+am 0.5 4.0
+bus chords
+adsr 0.01 1.1 0.0 0.0
+lifetime envelope
+filter lowpass 1200
+partial 1.0 negative=0 note=-12 fm
+partial 1.0 negative=7 note=-12 fm
+partial 1.0 negative=0 fm
+partial 1.0 negative=3 fm
+partial 1.0 negative=7 fm
+
+instrument cord-base
+volume 0.3
+fm 0.8 0.8
+bus bass
+adsr 0.01 2.0 0.0 0.0
+lifetime envelope
+partial 1.0 note=-24 fm am
+partial 0.5 note=-12 fm am
+partial 0.2 note=-24 times=3
+partial 0.05 note=-24 times=5
+
+instrument cord-base-inverted
+volume 0.3
+fm 0.8 0.8
+bus bass
+adsr 0.01 2.0 0.0 0.0
+lifetime envelope
+partial 1.0 negative=0 note=-24 fm am
+partial 0.5 negative=0 note=-12 fm am
+partial 0.2 negative=0 note=-24 times=3
+partial 0.05 negative=0 note=-24 times=5
+)";
+}
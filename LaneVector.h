@@ -0,0 +1,62 @@
+/*
+	This file contains the vector of lanes the SIMD kernels are written with, a register of 8 (AVX2), 4 (SSE2)
+	or 1 float. Every lane is an independent value, the kernels never mix lanes
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include "SampleFormat.h"
+
+namespace synth {
+    // Vector of lanes, one register wide
+#if MUVE_SIMD_AVX2
+    struct LaneVector {
+        static constexpr unsigned int WIDTH = 8;
+        __m256 Value;
+
+        static LaneVector Load(const float *p) { return {_mm256_loadu_ps(p)}; }
+        static LaneVector Set(const float value) { return {_mm256_set1_ps(value)}; }
+        void Store(float *p) const { _mm256_storeu_ps(p, Value); }
+
+        friend LaneVector operator+(const LaneVector a, const LaneVector b) { return {_mm256_add_ps(a.Value, b.Value)}; }
+        friend LaneVector operator-(const LaneVector a, const LaneVector b) { return {_mm256_sub_ps(a.Value, b.Value)}; }
+        friend LaneVector operator*(const LaneVector a, const LaneVector b) { return {_mm256_mul_ps(a.Value, b.Value)}; }
+        friend LaneVector Min(const LaneVector a, const LaneVector b) { return {_mm256_min_ps(a.Value, b.Value)}; }
+        friend LaneVector Max(const LaneVector a, const LaneVector b) { return {_mm256_max_ps(a.Value, b.Value)}; }
+        friend LaneVector Round(const LaneVector a) { return {_mm256_cvtepi32_ps(_mm256_cvtps_epi32(a.Value))}; }
+    };
+#elif MUVE_SIMD_SSE2
+    struct LaneVector {
+        static constexpr unsigned int WIDTH = 4;
+        __m128 Value;
+
+        static LaneVector Load(const float *p) { return {_mm_loadu_ps(p)}; }
+        static LaneVector Set(const float value) { return {_mm_set1_ps(value)}; }
+        void Store(float *p) const { _mm_storeu_ps(p, Value); }
+
+        friend LaneVector operator+(const LaneVector a, const LaneVector b) { return {_mm_add_ps(a.Value, b.Value)}; }
+        friend LaneVector operator-(const LaneVector a, const LaneVector b) { return {_mm_sub_ps(a.Value, b.Value)}; }
+        friend LaneVector operator*(const LaneVector a, const LaneVector b) { return {_mm_mul_ps(a.Value, b.Value)}; }
+        friend LaneVector Min(const LaneVector a, const LaneVector b) { return {_mm_min_ps(a.Value, b.Value)}; }
+        friend LaneVector Max(const LaneVector a, const LaneVector b) { return {_mm_max_ps(a.Value, b.Value)}; }
+        friend LaneVector Round(const LaneVector a) { return {_mm_cvtepi32_ps(_mm_cvtps_epi32(a.Value))}; }
+    };
+#else
+    struct LaneVector {
+        static constexpr unsigned int WIDTH = 1;
+        float Value;
+
+        static LaneVector Load(const float *p) { return {*p}; }
+        static LaneVector Set(const float value) { return {value}; }
+        void Store(float *p) const { *p = Value; }
+
+        friend LaneVector operator+(const LaneVector a, const LaneVector b) { return {a.Value + b.Value}; }
+        friend LaneVector operator-(const LaneVector a, const LaneVector b) { return {a.Value - b.Value}; }
+        friend LaneVector operator*(const LaneVector a, const LaneVector b) { return {a.Value * b.Value}; }
+        friend LaneVector Min(const LaneVector a, const LaneVector b) { return {std::min(a.Value, b.Value)}; }
+        friend LaneVector Max(const LaneVector a, const LaneVector b) { return {std::max(a.Value, b.Value)}; }
+        friend LaneVector Round(const LaneVector a) { return {std::nearbyint(a.Value)}; }
+    };
+#endif
+}
@@ -0,0 +1,250 @@
+/*
+	This file contains the mixer, the notes of every instrument are rendered into the bus of the instrument
+	(drums, chords, bass or the user notes) and the buses are summed into the master bus.
+	Every bus has its own gain, pan, mute and a chain of effects run over the whole block, so an effect costs one
+	call per block instead of one per note and sample. All the buffers are allocated before the audio starts
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "Filters.h"
+#include "SynthUtils.h"
+
+namespace synth {
+    // An effect run over a bus a block at a time, 'right' is nullptr for a mono mix
+    struct BusEffect {
+        virtual ~BusEffect() = default;
+
+        virtual void Process(float *left, float *right, unsigned int frames) = 0;
+    };
+
+    // One of the per-sample filters applied to a whole block, each side keeps its own state. A new cutoff is
+    // ramped to, the filter is only set again once every CONTROL_BLOCK_FRAMES while it moves
+    template<typename F>
+    struct FilterEffect : public BusEffect {
+        F Left;
+        F Right;
+
+        // The cutoff gets to 'cutoffFrequency' after 'rampFrames', 0 sets it on the spot
+        void SetFilterPresets(const double sampleTimeFrequency, const double cutoffFrequency,
+                              const unsigned int rampFrames = 0) {
+            if (sampleTimeFrequency != _sampleTimeFrequency) {
+                _sampleTimeFrequency = sampleTimeFrequency;
+                _appliedCutoff = -1.0;
+            }
+            _cutoff.SetTarget(cutoffFrequency, rampFrames);
+        }
+
+        void Process(float *left, float *right, const unsigned int frames) override {
+            for (unsigned int start = 0; start < frames; start += CONTROL_BLOCK_FRAMES) {
+                const unsigned int end = std::min(start + CONTROL_BLOCK_FRAMES, frames);
+                const double cutoff = _cutoff.Advance(end - start);
+                if (cutoff != _appliedCutoff) {
+                    Left.SetFilterPresets(_sampleTimeFrequency, cutoff);
+                    Right.SetFilterPresets(_sampleTimeFrequency, cutoff);
+                    _appliedCutoff = cutoff;
+                }
+
+                for (unsigned int n = start; n < end; n++)
+                    left[n] = static_cast<float>(Left.FilterOutput(left[n]));
+                if (right != nullptr)
+                    for (unsigned int n = start; n < end; n++)
+                        right[n] = static_cast<float>(Right.FilterOutput(right[n]));
+            }
+        }
+
+    private:
+        SmoothedParameter _cutoff;
+        double _sampleTimeFrequency = 0.0;
+        double _appliedCutoff = -1.0; // cutoff the filters were last set to
+    };
+
+    // A state variable filter over a bus. The settings can be changed between blocks, the filter moves to them
+    // over the next block
+    struct StateVariableEffect : public BusEffect {
+        int Type;
+        double Cutoff;
+        double Q;
+
+        StateVariableEffect(const int type, const double cutoff, const double q, const double sampleRate)
+            : Type(type), Cutoff(cutoff), Q(q), _sampleRate(sampleRate) {
+        }
+
+        void Process(float *left, float *right, const unsigned int frames) override {
+            if (Type != _type || Cutoff != _cutoff || Q != _q) {
+                // the first settings are taken on the spot
+                const unsigned int ramp = _type < 0 ? 0 : frames;
+                _left.SetParameters(Type, Cutoff, Q, _sampleRate, ramp);
+                _right.SetParameters(Type, Cutoff, Q, _sampleRate, ramp);
+                _type = Type;
+                _cutoff = Cutoff;
+                _q = Q;
+            }
+            _left.Process(left, frames);
+            if (right != nullptr)
+                _right.Process(right, frames);
+        }
+
+    private:
+        StateVariableFilter _left;
+        StateVariableFilter _right;
+        double _sampleRate;
+        int _type = -1; // settings the filters were last given
+        double _cutoff = 0.0;
+        double _q = 0.0;
+    };
+
+    // A Butterworth low or high pass of order 2N over a bus, N biquads one after the other. The cutoff can be
+    // changed between blocks, the filter moves to it over the next block
+    template<unsigned int N>
+    struct ButterworthEffect : public BusEffect {
+        int Type;
+        double Cutoff;
+
+        ButterworthEffect(const int type, const double cutoff, const double sampleRate)
+            : Type(type), Cutoff(cutoff), _sampleRate(sampleRate) {
+        }
+
+        void Process(float *left, float *right, const unsigned int frames) override {
+            if (Type != _type || Cutoff != _cutoff) {
+                // the first settings are taken on the spot
+                const unsigned int ramp = _type < 0 ? 0 : frames;
+                _left.SetButterworth(Type, Cutoff, _sampleRate, ramp);
+                _right.SetButterworth(Type, Cutoff, _sampleRate, ramp);
+                _type = Type;
+                _cutoff = Cutoff;
+            }
+            _left.Process(left, frames);
+            if (right != nullptr)
+                _right.Process(right, frames);
+        }
+
+    private:
+        BiquadCascade<N> _left;
+        BiquadCascade<N> _right;
+        double _sampleRate;
+        int _type = -1; // settings the filters were last given
+        double _cutoff = 0.0;
+    };
+
+    // Gain, pan and mute can be changed between blocks, the mixer ramps to them over the next block
+    struct MixerBus {
+        double Gain = 1.0;
+        double Pan = 0.0; // -1 (left) to 1 (right), only used by stereo mixes
+        bool Muted = false;
+        std::vector<std::unique_ptr<BusEffect> > Effects; // run in order, before the gain
+
+        float *Left() { return _left.data(); }
+        float *Right() { return _right.data(); }
+
+    private:
+        friend class Mixer;
+        std::vector<float> _left;
+        std::vector<float> _right;
+        SmoothedParameter _leftGain;
+        SmoothedParameter _rightGain;
+    };
+
+    class Mixer {
+    public:
+        MixerBus Buses[BUS_COUNT];
+        MixerBus Master;
+
+        // Sizes every bus for blocks of up to 'frames', called before the audio starts. Mixing a longer block
+        // grows the buses on the render thread
+        void Prepare(const unsigned int frames) {
+            if (frames <= _frames)
+                return;
+            _frames = frames;
+            for (MixerBus &bus: Buses) {
+                bus._left.resize(frames);
+                bus._right.resize(frames);
+            }
+            Master._left.resize(frames);
+            Master._right.resize(frames);
+            for (int bus = 0; bus < BUS_COUNT; bus++) {
+                _left[bus] = Buses[bus].Left();
+                _right[bus] = Buses[bus].Right();
+            }
+        }
+
+        // Silences the first 'frames' of every bus before the notes are rendered into them
+        void Clear(const unsigned int frames) {
+            Prepare(frames);
+            for (MixerBus &bus: Buses) {
+                std::fill(bus._left.begin(), bus._left.begin() + frames, 0.0f);
+                std::fill(bus._right.begin(), bus._right.begin() + frames, 0.0f);
+            }
+        }
+
+        // Left and right buffers of every bus, in bus order
+        float *const *Left() const { return _left; }
+        float *const *Right() const { return _right; }
+
+        // Runs the effects of every bus, sums them into the master bus and writes it to the first one or two
+        // channels of 'out'. Mono mixes only use the left buffers
+        void Mix(float *out, const unsigned int frames, const unsigned int channels) {
+            const bool isStereo = channels > 1;
+            float *masterLeft = Master.Left();
+            float *masterRight = Master.Right();
+            std::fill(masterLeft, masterLeft + frames, 0.0f);
+            std::fill(masterRight, masterRight + frames, 0.0f);
+
+            for (MixerBus &bus: Buses) {
+                UpdateGains(bus, frames, isStereo);
+                // a muted bus is still faded out before it is skipped
+                if (bus._leftGain.Current() == 0.0 && bus._rightGain.Current() == 0.0 && !bus._leftGain.IsRamping()
+                    && !bus._rightGain.IsRamping())
+                    continue;
+                Process(bus, frames, isStereo);
+                Add(bus, masterLeft, masterRight, frames, isStereo);
+            }
+
+            Process(Master, frames, isStereo);
+            UpdateGains(Master, frames, isStereo);
+            for (unsigned int n = 0; n < frames; n++) {
+                out[n * channels] = masterLeft[n] * static_cast<float>(Master._leftGain.Advance());
+                if (isStereo)
+                    out[n * channels + 1] = masterRight[n] * static_cast<float>(Master._rightGain.Advance());
+            }
+        }
+
+    private:
+        unsigned int _frames = 0;
+        float *_left[BUS_COUNT]{};
+        float *_right[BUS_COUNT]{};
+
+        static void Process(MixerBus &bus, const unsigned int frames, const bool isStereo) {
+            for (const std::unique_ptr<BusEffect> &effect: bus.Effects)
+                effect->Process(bus.Left(), isStereo ? bus.Right() : nullptr, frames);
+        }
+
+        // The pan keeps a centered bus at its own level, so only moving it changes the mix. The new gains are
+        // reached at the end of the block
+        static void UpdateGains(MixerBus &bus, const unsigned int frames, const bool isStereo) {
+            const double gain = bus.Muted ? 0.0 : bus.Gain;
+            double leftGain = gain, rightGain = gain;
+            if (isStereo && bus.Pan != 0.0) {
+                PanToGains(bus.Pan, leftGain, rightGain);
+                leftGain *= gain * std::sqrt(2.0);
+                rightGain *= gain * std::sqrt(2.0);
+            }
+            bus._leftGain.SetTarget(leftGain, frames);
+            // mono mixes never move along the right ramp
+            bus._rightGain.SetTarget(rightGain, isStereo ? frames : 0);
+        }
+
+        static void Add(MixerBus &bus, float *left, float *right, const unsigned int frames, const bool isStereo) {
+            const float *busLeft = bus.Left();
+            const float *busRight = bus.Right();
+            for (unsigned int n = 0; n < frames; n++) {
+                left[n] += busLeft[n] * static_cast<float>(bus._leftGain.Advance());
+                if (isStereo)
+                    right[n] += busRight[n] * static_cast<float>(bus._rightGain.Advance());
+            }
+        }
+    };
+}
@@ -0,0 +1,90 @@
+/*
+	This file contains the mood input used when there is no sensor connected, for offline renders.
+	The mood can be a constant, a curve scripted on the command line or a session recorded to a file.
+	A curve is a list of points "bar=mood", in between points the mood moves in a straight line
+*/
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class MoodSource {
+public:
+    explicit MoodSource(const double mood = 10.0) : _points{{0.0, mood}} {
+    }
+
+    // "<mood>", "curve:<bar>=<mood>,<bar>=<mood>,..." or "file:<path>". Returns false when the option can not be
+    // read, the source is left untouched
+    bool Parse(const std::string &option) {
+        std::vector<std::pair<double, double> > points;
+
+        if (option.compare(0, 6, "curve:") == 0) {
+            std::stringstream curve(option.substr(6));
+            std::string point;
+            while (std::getline(curve, point, ','))
+                if (!ParsePoint(point, points.size(), points))
+                    return false;
+        } else if (option.compare(0, 5, "file:") == 0) {
+            std::ifstream file(option.substr(5));
+            if (!file)
+                return false;
+
+            // one mood per line for consecutive bars, or "<bar> <mood>" per line
+            std::string line;
+            while (std::getline(file, line))
+                if (line.find_first_not_of(" \t\r") != std::string::npos && line[0] != '#' &&
+                    !ParsePoint(line, points.size(), points))
+                    return false;
+        } else if (!ParsePoint(option, 0, points)) {
+            return false;
+        }
+
+        if (points.empty())
+            return false;
+
+        std::stable_sort(points.begin(), points.end(),
+                         [](const std::pair<double, double> &a, const std::pair<double, double> &b) {
+                             return a.first < b.first;
+                         });
+        _points = std::move(points);
+        return true;
+    }
+
+    // Mood at a point of the song, measured in bars. Before the first and after the last point the mood holds
+    double MoodAt(const double bar) const {
+        if (bar <= _points.front().first)
+            return _points.front().second;
+        if (bar >= _points.back().first)
+            return _points.back().second;
+
+        const auto next = std::upper_bound(_points.begin(), _points.end(), bar,
+                                           [](const double value, const std::pair<double, double> &point) {
+                                               return value < point.first;
+                                           });
+        const auto previous = next - 1;
+        const double t = (bar - previous->first) / (next->first - previous->first);
+        return previous->second + (next->second - previous->second) * t;
+    }
+
+private:
+    std::vector<std::pair<double, double> > _points; // bar and mood, sorted by bar
+
+    // "<mood>" is placed at 'defaultBar', "<bar>=<mood>" and "<bar> <mood>" give the bar
+    static bool ParsePoint(std::string text, const size_t defaultBar, std::vector<std::pair<double, double> > &points) {
+        std::replace(text.begin(), text.end(), '=', ' ');
+        std::stringstream stream(text);
+        double first, second;
+        if (!(stream >> first))
+            return false;
+
+        if (stream >> second)
+            points.emplace_back(first, second);
+        else
+            points.emplace_back(static_cast<double>(defaultBar), first);
+        return true;
+    }
+};
@@ -1,206 +1,331 @@
 /*
 	This file controls audio output to the hardware.
-	Currently, Windows only
+	The blocks are rendered here and handed over to an audio sink, which talks to the device (or file)
 */
 #pragma once
 
-//Might need to uncomment to run on Visual Studio
-//#pragma comment(lib, "winmm.lib")
-
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <thread>
 #include <atomic>
-#include <condition_variable>
-#include <Windows.h>
-#include <cmath>
-
-template<class T>
-class NoiseMaker {
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include "AudioSink.h"
+#include "AudioTelemetry.h"
+#include "RealTime.h"
+#include "SampleFormat.h"
+
+// Block render callback. Fills 'frames' interleaved frames of 'channels' samples, in the range [-1, 1],
+// starting at the frame index 'startFrame' of the output stream
+using RenderFunction = void (*)(float *out, uint32_t frames, uint32_t channels, uint64_t startFrame, void *context);
+
+// Picks how many blocks the device may hold. It starts at the minimum, grows one block on every underrun or
+// when the render headroom gets tight, and gives a block back after a long stretch without trouble
+class AdaptiveQueue {
 public:
-    explicit NoiseMaker(const std::wstring &outputDevice, const unsigned int sampleRate = 44100,
-                        const unsigned int channels = 1,
-                        const unsigned int blocks = 8, const unsigned int blockSamples = 512) {
-        if (!Create(outputDevice, sampleRate, channels, blocks, blockSamples))
-            std::cout << "Could not correctly initiate Noise Maker class" << std::endl;
+    // Blocks whose render time left less than this fraction of the block period
+    static constexpr double TIGHT_HEADROOM = 0.25;
+    static constexpr unsigned int TIGHT_BLOCKS_TO_GROW = 4;
+    static constexpr double CALM_SECONDS_TO_SHRINK = 10.0;
+
+    void Reset(const unsigned int minBlocks, const unsigned int maxBlocks, const double blocksPerSecond) {
+        _maxBlocks = std::max(maxBlocks, 1u);
+        _minBlocks = std::min(std::max(minBlocks, 1u), _maxBlocks);
+        _limit = _minBlocks;
+        _calmBlocksToShrink = static_cast<unsigned int>(CALM_SECONDS_TO_SHRINK * blocksPerSecond);
+        _tightBlocks = 0;
+        _calmBlocks = 0;
     }
 
-    ~NoiseMaker() {
-        Stop();
-        Destroy();
+    // Returns true when the limit changed
+    bool Update(const int64_t renderNanos, const int64_t periodNanos, const uint64_t newUnderruns) {
+        const bool tight = static_cast<double>(periodNanos - renderNanos) <
+                           TIGHT_HEADROOM * static_cast<double>(periodNanos);
+        if (newUnderruns > 0 || (tight && ++_tightBlocks >= TIGHT_BLOCKS_TO_GROW)) {
+            _tightBlocks = 0;
+            _calmBlocks = 0;
+            return Change(_limit + 1);
+        }
+
+        if (tight) {
+            _calmBlocks = 0;
+            return false;
+        }
+
+        if (++_calmBlocks < _calmBlocksToShrink)
+            return false;
+
+        _calmBlocks = 0;
+        _tightBlocks = 0;
+        return Change(_limit - 1);
     }
 
-    double UserProcess(int channel, double dTime) { return 0.0; }
+    unsigned int Limit() const { return _limit; }
+
+private:
+    unsigned int _minBlocks = 1;
+    unsigned int _maxBlocks = 1;
+    unsigned int _limit = 1;
+    unsigned int _calmBlocksToShrink = 0;
+    unsigned int _tightBlocks = 0;
+    unsigned int _calmBlocks = 0;
+
+    bool Change(const unsigned int limit) {
+        const unsigned int clamped = std::min(std::max(limit, _minBlocks), _maxBlocks);
+        if (clamped == _limit)
+            return false;
+        _limit = clamped;
+        return true;
+    }
+};
+
+// Everything that does not depend on the output sample format
+class NoiseMakerBase {
+public:
+    virtual ~NoiseMakerBase() = default;
 
-    const double &GetTime() const { return _globalTime; }
+    double UserProcess(int, double) { return 0.0; }
 
-    void SetUserFunction(double (*func)(int, double)) { _userFunction = func; }
+    // Master clock of the engine, the frame index the next rendered block starts at. It only ever grows and is
+    // safe to read from any thread
+    uint64_t GetFrame() const { return _frameCount.load(std::memory_order_acquire); }
 
-    static std::vector<std::wstring> Enumerate() {
-        const unsigned int deviceCount = waveOutGetNumDevs();
-        std::vector<std::wstring> devices;
-        WAVEOUTCAPS woc;
+    unsigned int GetSampleRate() const { return _sampleRate; }
 
-        for (int n = 0; n < deviceCount; n++)
-            if (waveOutGetDevCaps(n, &woc, sizeof(WAVEOUTCAPS)) == S_OK)
-                devices.emplace_back(woc.szPname, woc.szPname + wcslen(reinterpret_cast<const wchar_t *>(woc.szPname)));
+    double GetTime() const { return static_cast<double>(GetFrame()) / static_cast<double>(_sampleRate); }
 
-        return devices;
+    // Legacy per-sample callback, it is driven through a block render adapter
+    void SetUserFunction(double (*func)(int, double)) {
+        _userFunction = func;
+        SetRenderFunction(&NoiseMakerBase::UserFunctionAdapter, this);
     }
 
-private:
-    double (*_userFunction)(int, double){};
+    // Sets the function that renders a whole block of audio in one call
+    void SetRenderFunction(RenderFunction func, void *context = nullptr) {
+        _renderContext = context;
+        _renderFunction = func;
+    }
 
-    unsigned int _sampleRate{};
-    unsigned int _channels{};
-    unsigned int _blockCount{};
-    unsigned int _blockSamples{};
-    unsigned int _blockCurrent{};
+    // Adds triangular dither before integer outputs are rounded, float outputs ignore it
+    void SetDither(const bool enabled) { _ditherEnabled = enabled; }
 
-    T *_blockMemory;
-    WAVEHDR *_waveHeaders{};
-    HWAVEOUT _hwDevice{};
+    // Per-block render statistics, safe to read from any thread
+    const AudioTelemetry &GetTelemetry() const { return _telemetry; }
 
-    std::thread _thread;
-    bool _ready{};
-    std::atomic<unsigned int> _blockFree{};
-    std::condition_variable _cvBlockNotZero;
-    std::mutex _muxBlockNotZero;
+    // Lets the render thread move the queue depth between 'minBlocks' and the block count while it plays.
+    // Nothing is reallocated, the sink is only told how many of its blocks it may hold at once
+    void SetAdaptiveQueue(const bool enabled, const unsigned int minBlocks = 2) {
+        _adaptiveMinBlocks = minBlocks;
+        _adaptiveEnabled = enabled;
+    }
 
-    double _globalTime{};
+    // Blocks the device is currently allowed to hold
+    unsigned int GetQueueLimit() const { return _queueLimit; }
 
-    bool Create(const std::wstring &outputDevice, unsigned int sampleRate, unsigned int channels,
-                unsigned int blocks, unsigned int blockSamples) {
-        _ready = true;
-        _sampleRate = sampleRate;
-        _channels = channels;
+    // Asks the render thread to switch to real-time mode, it does so before the next block
+    void SetRealTime(const RealTimeOptions &options) {
+        _realTimeOptions = options;
+        _realTimeApplied = false;
+        _realTimeRequested = true;
+    }
+
+    // False until the render thread has applied the requested real-time mode
+    bool GetRealTimeReport(RealTimeReport &report) const {
+        if (!_realTimeApplied)
+            return false;
+        report = _realTimeReport;
+        return true;
+    }
+
+protected:
+    bool Create(IAudioSink *sink, const AudioFormat &format, unsigned int blocks, unsigned int blockSamples) {
+        _sampleRate = format.SampleRate;
+        _channels = format.Channels;
         _blockCount = blocks;
         _blockSamples = blockSamples;
-        _blockFree = _blockCount;
-        _blockCurrent = 0;
-        _blockMemory = nullptr;
-        _waveHeaders = nullptr;
-        _userFunction = nullptr;
-
-        // Validate device
-        std::vector<std::wstring> devices = Enumerate();
-        const auto d = std::find(devices.begin(), devices.end(), outputDevice);
-        if (d != devices.end()) {
-            const unsigned int nDeviceID = std::distance(devices.begin(), d);
-            WAVEFORMATEX waveFormat;
-            waveFormat.wFormatTag = WAVE_FORMAT_PCM;
-            waveFormat.nSamplesPerSec = _sampleRate;
-            waveFormat.wBitsPerSample = sizeof(T) * 8;
-            waveFormat.nChannels = _channels;
-            waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
-            waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
-            waveFormat.cbSize = 0;
-
-            // Open Device if valid
-            if (waveOutOpen(&_hwDevice, nDeviceID, &waveFormat, reinterpret_cast<DWORD_PTR>(WaveOutProcWrap),
-                            reinterpret_cast<DWORD_PTR>(this),CALLBACK_FUNCTION) != S_OK)
-                return Destroy();
-        }
+        _sink = sink;
+        _mixBuffer = nullptr;
 
-        // Allocate Wave Block Memory
-        _blockMemory = new T[_blockCount * _blockSamples];
-        if (_blockMemory == nullptr)
+        if (_sink == nullptr || !_sink->Open(format, _blockCount, _blockSamples))
             return Destroy();
-        ZeroMemory(_blockMemory, sizeof(T) * _blockCount * _blockSamples);
 
-        _waveHeaders = new WAVEHDR[_blockCount];
-        ZeroMemory(_waveHeaders, sizeof(WAVEHDR) * _blockCount);
-
-        // Link headers to block memory
-        for (unsigned int n = 0; n < _blockCount; n++) {
-            _waveHeaders[n].dwBufferLength = _blockSamples * sizeof(T);
-            _waveHeaders[n].lpData = reinterpret_cast<LPSTR>(_blockMemory + (n * _blockSamples));
-        }
+        // Block sized buffer the render function mixes into, before conversion to the output format
+        _mixBuffer = new float[_blockSamples]();
 
-        _thread = std::thread(&NoiseMaker::MainThread, this);
+        _ready = true;
+        _thread = std::thread(&NoiseMakerBase::MainThread, this);
 
         return true;
     }
 
-    bool Destroy() const {
-        delete[] _blockMemory;
-        delete[] _waveHeaders;
+    bool Destroy() {
+        if (_sink != nullptr)
+            _sink->Close();
+
+        delete[] _mixBuffer;
+        _mixBuffer = nullptr;
         return false;
     }
 
     void Stop() {
         _ready = false;
-        _thread.join();
+        if (_thread.joinable())
+            _thread.join();
     }
 
-    double Clip(const double sample, const double max) {
-        return sample >= 0.0 ? fmin(sample, max) : fmax(sample, -max);
-    }
+    // Converts a block from the mix buffer into the memory of a sink block
+    virtual void ConvertBlock(const float *in, void *out, size_t count, DitherState &dither) = 0;
 
+private:
+    double (*_userFunction)(int, double){};
+    RenderFunction _renderFunction{};
+    void *_renderContext{};
 
-    // Static wrapper for sound card handler
-    static void CALLBACK
-    WaveOutProcWrap(HWAVEOUT waveOut, UINT msg, DWORD_PTR instance, DWORD_PTR param1, DWORD_PTR param2) {
-        if (msg != WOM_DONE) return;
+    unsigned int _sampleRate{};
+    unsigned int _channels{};
+    unsigned int _blockCount{};
+    unsigned int _blockSamples{};
 
-        auto *noiseMakerInstance = reinterpret_cast<NoiseMaker<T> *>(instance);
-        noiseMakerInstance->WaveOutProc(msg);
-    }
+    IAudioSink *_sink{};
+    float *_mixBuffer{};
+    std::atomic<bool> _ditherEnabled{};
+    std::atomic<bool> _adaptiveEnabled{};
+    std::atomic<unsigned int> _adaptiveMinBlocks{};
+    std::atomic<unsigned int> _queueLimit{};
+    AudioTelemetry _telemetry;
 
-    // Handler for sound card request for more data
-    void WaveOutProc(UINT msg) {
-        ++_blockFree;
-        std::unique_lock<std::mutex> lm(_muxBlockNotZero);
-        _cvBlockNotZero.notify_one();
+    RealTimeOptions _realTimeOptions;
+    RealTimeReport _realTimeReport;
+    std::atomic<bool> _realTimeRequested{};
+    std::atomic<bool> _realTimeApplied{};
+
+    std::thread _thread;
+    std::atomic<bool> _ready{};
+
+    std::atomic<uint64_t> _frameCount{};
+
+    // Adapts the per-sample user function to the block render interface
+    static void UserFunctionAdapter(float *out, const uint32_t frames, const uint32_t channels,
+                                    const uint64_t startFrame, void *context) {
+        auto *noiseMaker = static_cast<NoiseMakerBase *>(context);
+        const double timeStep = 1.0 / static_cast<double>(noiseMaker->_sampleRate);
+
+        for (uint32_t n = 0; n < frames; n++) {
+            const double time = static_cast<double>(startFrame + n) * timeStep;
+            for (uint32_t c = 0; c < channels; c++)
+                out[n * channels + c] = static_cast<float>(noiseMaker->_userFunction(static_cast<int>(c), time));
+        }
     }
 
-    // Main thread. This loop responds to requests from the sound card to fill 'blocks'
-    // with audio data. If no requests are available it goes dormant until the sound
-    // card is ready for more data. The block is filled by the "user" in some manner
-    // and then issued to the sound card.
+    // Main thread. This loop asks the sink for free 'blocks' to fill with audio data. If none are available the
+    // sink keeps it dormant until the sound card is ready for more data (file and null sinks never wait).
+    // The block is filled by the "user" in some manner and then handed to the sink.
     void MainThread() {
-        _globalTime = 0.0;
-        const double timeStep = 1.0 / static_cast<double>(_sampleRate);
-
-        // get maximum integer for a type at run-time
-        const auto maxSample = pow(2, sizeof(T) * 8 - 1) - 1;
+        _frameCount = 0;
+        const unsigned int frames = _blockSamples / _channels;
+        const auto periodNanos = static_cast<int64_t>(1e9 * frames / static_cast<double>(_sampleRate));
+        uint64_t underrunsSeen = 0;
+        DitherState dither;
+        AdaptiveQueue adaptiveQueue;
+        bool adaptive = false;
+        _queueLimit = _blockCount;
 
         while (_ready) {
-            // Wait for block to become available
-            if (_blockFree == 0) {
-                std::unique_lock<std::mutex> lm(_muxBlockNotZero);
-                while (_blockFree == 0) // sometimes, Windows signals incorrectly
-                    _cvBlockNotZero.wait(lm);
+            // the adaptive mode starts from the smallest queue every time it is switched on
+            if (adaptive != _adaptiveEnabled) {
+                adaptive = _adaptiveEnabled;
+                adaptiveQueue.Reset(_adaptiveMinBlocks, _blockCount, _sampleRate / static_cast<double>(frames));
+                _queueLimit = adaptive ? adaptiveQueue.Limit() : _blockCount;
+                _sink->SetQueueLimit(_queueLimit);
             }
 
-            --_blockFree;
+            if (_realTimeRequested.exchange(false)) {
+                _realTimeReport = RealTime::ApplyToCurrentThread(_realTimeOptions);
+                RealTime::Prefault(_mixBuffer, _blockSamples * sizeof(float));
+                _realTimeApplied = true;
+            }
 
-            // Prepare block for processing
-            if (_waveHeaders[_blockCurrent].dwFlags & WHDR_PREPARED)
-                waveOutUnprepareHeader(_hwDevice, &_waveHeaders[_blockCurrent], sizeof(WAVEHDR));
+            void *block = _sink->AcquireBlock();
+            const unsigned int queueDepth = _sink->QueuedBlocks();
+            const auto renderStart = std::chrono::steady_clock::now();
+
+            // User Process, the whole block is rendered in one call
+            if (_renderFunction == nullptr)
+                std::fill(_mixBuffer, _mixBuffer + frames * _channels, static_cast<float>(UserProcess(0, GetTime())));
+            else
+                _renderFunction(_mixBuffer, frames, _channels, _frameCount.load(std::memory_order_relaxed),
+                                _renderContext);
+
+            dither.Enabled = _ditherEnabled;
+            ConvertBlock(_mixBuffer, block, frames * _channels, dither);
+
+            const auto renderNanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - renderStart).count();
+            const uint64_t underruns = _sink->Underruns();
+            _telemetry.RecordUnderruns(underruns - underrunsSeen);
+            _telemetry.RecordBlock(renderNanos, periodNanos, queueDepth);
+            if (adaptive && adaptiveQueue.Update(renderNanos, periodNanos, underruns - underrunsSeen)) {
+                _queueLimit = adaptiveQueue.Limit();
+                _sink->SetQueueLimit(_queueLimit);
+            }
+            underrunsSeen = underruns;
 
-            T newSample;
-            const int currentBlock = _blockCurrent * _blockSamples;
+            _frameCount.fetch_add(frames, std::memory_order_release);
 
-            for (unsigned int n = 0; n < _blockSamples; n += _channels) {
-                for (int c = 0; c < _channels; c++) {
-                    // User Process
-                    if (_userFunction == nullptr)
-                        newSample = static_cast<T>(Clip(UserProcess(c, _globalTime), 1.0) * maxSample);
-                    else
-                        newSample = static_cast<T>(Clip(_userFunction(c, _globalTime), 1.0) * maxSample);
+            // Send block to the output
+            _sink->SubmitBlock();
+        }
+    }
+};
 
-                    _blockMemory[currentBlock + n + c] = newSample;
-                }
+// T is the sample type handed to the sink, any type with SampleTraits: int16_t, Int24, int32_t or float
+template<class T>
+class NoiseMaker : public NoiseMakerBase {
+public:
+    // The sink is not owned, it has to outlive the noise maker
+    explicit NoiseMaker(IAudioSink *sink, const unsigned int sampleRate = 44100,
+                        const unsigned int channels = 1,
+                        const unsigned int blocks = 8, const unsigned int blockSamples = 512) {
+        AudioFormat format{};
+        format.SampleRate = sampleRate;
+        format.Channels = channels;
+        format.BitsPerSample = SampleTraits<T>::Bits;
+        format.IsFloat = SampleTraits<T>::IsFloat;
 
-                _globalTime = _globalTime + timeStep;
-            }
+        if (!Create(sink, format, blocks, blockSamples))
+            std::cout << "Could not correctly initiate Noise Maker class" << std::endl;
+    }
 
-            // Send block to sound device
-            waveOutPrepareHeader(_hwDevice, &_waveHeaders[_blockCurrent], sizeof(WAVEHDR));
-            waveOutWrite(_hwDevice, &_waveHeaders[_blockCurrent], sizeof(WAVEHDR));
-            _blockCurrent++;
-            _blockCurrent %= _blockCount;
-        }
+    // The thread has to stop before this class is gone, it calls ConvertBlock
+    ~NoiseMaker() override {
+        Stop();
+        Destroy();
+    }
+
+private:
+    void ConvertBlock(const float *in, void *out, const size_t count, DitherState &dither) override {
+        ConvertSamples(in, static_cast<T *>(out), count, dither);
     }
 };
+
+// Picks the noise maker for an output format chosen at run time
+inline std::unique_ptr<NoiseMakerBase> CreateNoiseMaker(const SampleFormat format, IAudioSink *sink,
+                                                        const unsigned int sampleRate, const unsigned int channels,
+                                                        const unsigned int blocks, const unsigned int blockSamples) {
+    switch (format) {
+        case SAMPLE_INT24:
+            return std::unique_ptr<NoiseMakerBase>(
+                new NoiseMaker<Int24>(sink, sampleRate, channels, blocks, blockSamples));
+        case SAMPLE_INT32:
+            return std::unique_ptr<NoiseMakerBase>(
+                new NoiseMaker<int32_t>(sink, sampleRate, channels, blocks, blockSamples));
+        case SAMPLE_FLOAT32:
+            return std::unique_ptr<NoiseMakerBase>(
+                new NoiseMaker<float>(sink, sampleRate, channels, blocks, blockSamples));
+        default:
+            return std::unique_ptr<NoiseMakerBase>(
+                new NoiseMaker<int16_t>(sink, sampleRate, channels, blocks, blockSamples));
+    }
+}
@@ -59,6 +59,11 @@ namespace NGen {
     // Used to randomly shuffle the note types array
     std::default_random_engine rng = std::default_random_engine{};
 
+    // Random value from 0 to 9, drawn from the note generator engine instead of the global rand() state
+    inline int RandomPercentile() {
+        return std::uniform_int_distribution<int>(0, 9)(rng);
+    }
+
     // variables used for testing
     enum ChordChange {
         NORMAL,
@@ -126,7 +131,7 @@ namespace NGen {
         for (unsigned int i = 0; i < numberOfNotes - 1; i++) {
             char lastSequenceNote = notes[notes.size() - 1];
             char note;
-            const int randValue = rand() % 10;
+            const int randValue = RandomPercentile();
 
             if (randValue < 1)
                 note = lastSequenceNote;
@@ -144,7 +149,7 @@ namespace NGen {
     inline char GenerateNote(const char &axium) {
         const char lastSequenceNote = axium;
         char note;
-        const int randValue = rand() % 10;
+        const int randValue = RandomPercentile();
 
         if (randValue < 1)
             note = lastSequenceNote;
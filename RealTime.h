@@ -0,0 +1,114 @@
+/*
+	This file contains the opt-in real-time mode of the render thread: a real-time scheduling class (or the
+	highest nice value when that is not allowed), pinning to one core and locked, pre-faulted memory.
+	Every part needs privileges the process might not have, so each one reports back if it was granted
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+// Stack the render thread is allowed to grow into without a page fault
+constexpr size_t REAL_TIME_STACK_PREFAULT = 256 * 1024;
+
+struct RealTimeOptions {
+    bool Enabled = false;
+    int Core = -1; // -1 leaves the thread free to run on any core
+    bool LockMemory = true;
+};
+
+struct RealTimeReport {
+    bool FifoScheduling = false; // SCHED_FIFO, or time critical priority on Windows
+    bool NiceFallback = false; // only tried when the real-time class was refused
+    bool PinnedToCore = false;
+    bool MemoryLocked = false;
+    int Priority = 0;
+};
+
+namespace RealTime {
+    // Touches the pages of a buffer so they are mapped before the first block needs them
+    inline void Prefault(void *memory, const size_t bytes) {
+        if (memory == nullptr)
+            return;
+
+        volatile char *bytePointer = static_cast<char *>(memory);
+        for (size_t n = 0; n < bytes; n += 4096)
+            bytePointer[n] = bytePointer[n];
+        if (bytes > 0)
+            bytePointer[bytes - 1] = bytePointer[bytes - 1];
+    }
+
+    inline void PrefaultStack() {
+        char stack[REAL_TIME_STACK_PREFAULT];
+        volatile char *bytePointer = stack;
+        for (size_t n = 0; n < REAL_TIME_STACK_PREFAULT; n += 4096)
+            bytePointer[n] = 0;
+    }
+
+    // Applies the options to the calling thread, it has to be called from the render thread itself
+    inline RealTimeReport ApplyToCurrentThread(const RealTimeOptions &options) {
+        RealTimeReport report;
+        if (!options.Enabled)
+            return report;
+
+#ifdef _WIN32
+        report.FifoScheduling = SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+        report.Priority = GetThreadPriority(GetCurrentThread());
+        if (options.Core >= 0 && options.Core < 64)
+            report.PinnedToCore = SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << options.Core) != 0;
+        if (options.LockMemory)
+            PrefaultStack();
+#elif defined(__linux__)
+        // leave one step below the maximum for the kernel and the audio server threads
+        sched_param parameters{};
+        parameters.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters) == 0) {
+            report.FifoScheduling = true;
+            report.Priority = parameters.sched_priority;
+        } else {
+            // the nice value of a thread is set through its kernel thread id
+            const auto threadId = static_cast<id_t>(syscall(SYS_gettid));
+            report.NiceFallback = setpriority(PRIO_PROCESS, threadId, -20) == 0;
+            report.Priority = getpriority(PRIO_PROCESS, threadId);
+        }
+
+        if (options.Core >= 0 && options.Core < CPU_SETSIZE) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(options.Core, &cpus);
+            report.PinnedToCore = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus) == 0;
+        }
+
+        // locking the current pages maps them all, the stack is grown by hand so it gets locked too
+        if (options.LockMemory) {
+            report.MemoryLocked = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+            PrefaultStack();
+        }
+#endif
+        return report;
+    }
+
+    inline void PrintReport(const RealTimeReport &report) {
+        std::cout << "Real-time mode: ";
+        if (report.FifoScheduling)
+            std::cout << "FIFO priority " << report.Priority;
+        else if (report.NiceFallback)
+            std::cout << "FIFO refused, nice " << report.Priority;
+        else
+            std::cout << "normal priority";
+        std::cout << (report.PinnedToCore ? ", pinned" : ", not pinned")
+                << (report.MemoryLocked ? ", memory locked" : ", memory not locked") << std::endl;
+    }
+}
@@ -0,0 +1,203 @@
+/*
+	This file contains the render cache, the notes of instruments with a fixed life time are rendered once and
+	played back from memory the next times they are played. The sound of such a note before its envelope only
+	depends on the instrument and the note, so a cached one is a mix from a buffer instead of a voice.
+	The render thread never renders nor allocates: a note that is not cached is synthesized as usual and asked for,
+	a control thread renders it and hands it back. The cache keeps the notes used most recently within its memory
+	budget
+*/
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include "InstrumentDefinition.h"
+#include "SpscRing.h"
+
+namespace synth {
+    constexpr unsigned int RENDER_CACHE_ENTRIES = 256; // most notes kept at once, whatever their size
+    constexpr unsigned int RENDER_CACHE_REQUESTS = 64; // notes that can wait to be rendered at once
+
+    class RenderCache : public VoiceCache {
+    public:
+        RenderCache(const size_t maxBytes, const double &sampleRate)
+            : _maxBytes(maxBytes), _sampleRate(sampleRate), _requests(RENDER_CACHE_REQUESTS),
+              _rendered(RENDER_CACHE_REQUESTS), _retired(RENDER_CACHE_ENTRIES + RENDER_CACHE_REQUESTS) {
+            _entries.reserve(RENDER_CACHE_ENTRIES);
+            _pending.reserve(RENDER_CACHE_REQUESTS);
+        }
+
+        ~RenderCache() override {
+            for (const Entry &entry: _entries)
+                delete entry.Note;
+            RenderedNote *note;
+            while (_rendered.TryPop(note))
+                delete note;
+            while (_retired.TryPop(note))
+                delete note;
+            delete _unsent;
+        }
+
+        // Render thread, before the notes of a block starting on 'startFrame' are played. Takes the notes
+        // rendered since the last block in, making room for them by dropping the least recently used ones
+        void BeginBlock(const uint64_t startFrame, const unsigned int frames) {
+            _blockStart = startFrame;
+            _blockEnd = startFrame + frames;
+
+            RenderedNote *note;
+            while (_rendered.TryPop(note)) {
+                for (size_t n = 0; n < _pending.size(); n++) {
+                    if (_pending[n].Instrument == note->Instrument && _pending[n].Note == note->Note) {
+                        _pending[n] = _pending.back();
+                        _pending.pop_back();
+                        break;
+                    }
+                }
+
+                const size_t bytes = note->Samples.size() * sizeof(float);
+                if (bytes > _maxBytes) {
+                    Retire(note);
+                    continue;
+                }
+                while (!_entries.empty() && (_entries.size() == RENDER_CACHE_ENTRIES || _bytes + bytes > _maxBytes))
+                    if (!EvictOne())
+                        break;
+
+                if (_entries.size() < RENDER_CACHE_ENTRIES && _bytes + bytes <= _maxBytes) {
+                    _entries.push_back({note, ++_useCount, 0});
+                    _bytes += bytes;
+                } else {
+                    Retire(note); // everything left is still playing
+                }
+            }
+            _memoryBytes.store(_bytes, std::memory_order_relaxed);
+            _noteCount.store(static_cast<unsigned int>(_entries.size()), std::memory_order_relaxed);
+        }
+
+        // Render thread, when a note starts. A note that is not cached is asked for once
+        bool Find(const AdditiveInstrument *instrument, const int note, const float *&samples,
+                  unsigned int &length) override {
+            for (Entry &entry: _entries) {
+                if (entry.Note->Instrument != instrument || entry.Note->Note != note)
+                    continue;
+
+                entry.LastUsed = ++_useCount;
+                // the note started in this block reads the samples until then
+                entry.PlayingUntil = _blockEnd + entry.Note->Samples.size();
+                samples = entry.Note->Samples.data();
+                length = static_cast<unsigned int>(entry.Note->Samples.size());
+                _hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            _misses.fetch_add(1, std::memory_order_relaxed);
+            for (const Request &request: _pending)
+                if (request.Instrument == instrument && request.Note == note)
+                    return false;
+            if (_pending.size() < RENDER_CACHE_REQUESTS && _requests.TryPush({instrument, note}))
+                _pending.push_back({instrument, note});
+            return false;
+        }
+
+        // Control thread. Renders the notes asked for and frees the ones dropped, returns false when there was
+        // nothing to render
+        bool RenderPending() {
+            RenderedNote *retired;
+            while (_retired.TryPop(retired))
+                delete retired;
+
+            // a note the render thread had no room for is still asked for, so it is handed back before anything new
+            if (_unsent != nullptr) {
+                if (!_rendered.TryPush(_unsent))
+                    return true;
+                _unsent = nullptr;
+            }
+
+            Request request{};
+            if (!_requests.TryPop(request))
+                return false;
+
+            auto *note = new RenderedNote{request.Instrument, request.Note, {}};
+            request.Instrument->RenderNote(_sampleRate, request.Note, note->Samples);
+            if (!_rendered.TryPush(note))
+                _unsent = note;
+            return true;
+        }
+
+        // Can be read from any thread
+        uint64_t Hits() const { return _hits.load(std::memory_order_relaxed); }
+        uint64_t Misses() const { return _misses.load(std::memory_order_relaxed); }
+        size_t MemoryBytes() const { return _memoryBytes.load(std::memory_order_relaxed); }
+        unsigned int NoteCount() const { return _noteCount.load(std::memory_order_relaxed); }
+
+        double HitRate() const {
+            const uint64_t hits = Hits(), total = hits + Misses();
+            return total > 0 ? static_cast<double>(hits) / static_cast<double>(total) : 0.0;
+        }
+
+    private:
+        struct Request {
+            const AdditiveInstrument *Instrument;
+            int Note;
+        };
+
+        struct RenderedNote {
+            const AdditiveInstrument *Instrument;
+            int Note;
+            std::vector<float> Samples;
+        };
+
+        struct Entry {
+            RenderedNote *Note;
+            uint64_t LastUsed; // use count when it was last played, the lowest one is dropped first
+            uint64_t PlayingUntil; // frame the last note playing it can read until
+        };
+
+        size_t _maxBytes;
+        double _sampleRate;
+        RenderedNote *_unsent = nullptr; // only used by the control thread, rendered but not handed back yet
+
+        // only used by the render thread
+        std::vector<Entry> _entries;
+        std::vector<Request> _pending; // asked for and not back yet
+        size_t _bytes = 0;
+        uint64_t _useCount = 0;
+        uint64_t _blockStart = 0;
+        uint64_t _blockEnd = 0;
+
+        SpscRing<Request> _requests; // render thread to control thread
+        SpscRing<RenderedNote *> _rendered; // control thread to render thread
+        SpscRing<RenderedNote *> _retired; // dropped notes, freed by the control thread
+
+        std::atomic<uint64_t> _hits{};
+        std::atomic<uint64_t> _misses{};
+        std::atomic<size_t> _memoryBytes{};
+        std::atomic<unsigned int> _noteCount{};
+
+        // Drops the least recently used note no voice is playing, false if they are all playing
+        bool EvictOne() {
+            size_t victim = _entries.size();
+            for (size_t n = 0; n < _entries.size(); n++)
+                if (_entries[n].PlayingUntil <= _blockStart &&
+                    (victim == _entries.size() || _entries[n].LastUsed < _entries[victim].LastUsed))
+                    victim = n;
+            if (victim == _entries.size())
+                return false;
+
+            _bytes -= _entries[victim].Note->Samples.size() * sizeof(float);
+            Retire(_entries[victim].Note);
+            _entries[victim] = _entries.back();
+            _entries.pop_back();
+            return true;
+        }
+
+        // Every note alive is cached, on its way back from the control thread or retired, and a note is only
+        // rendered after the retired ones are freed, so the ring sized for the entries and requests never fills
+        void Retire(RenderedNote *note) {
+            const bool isQueued = _retired.TryPush(note);
+            assert(isQueued);
+            (void) isQueued;
+        }
+    };
+}
@@ -0,0 +1,314 @@
+/*
+	This file contains the output sample formats and the conversion from the internal float mix buffer to them.
+	The scale constants of every format are known at compile time, the conversion runs over a whole block
+	with SSE2 or AVX2 (depending on the compiler target), clamping and optionally adding TPDF dither
+*/
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MUVE_SIMD_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MUVE_SIMD_SSE2 1
+#endif
+
+enum SampleFormat {
+    SAMPLE_INT16,
+    SAMPLE_INT24,
+    SAMPLE_INT32,
+    SAMPLE_FLOAT32
+};
+
+// Packed little-endian 24 bit sample
+struct Int24 {
+    uint8_t Bytes[3];
+};
+
+template<class T>
+struct SampleTraits;
+
+template<>
+struct SampleTraits<int16_t> {
+    static constexpr SampleFormat Format = SAMPLE_INT16;
+    static constexpr unsigned int Bits = 16;
+    static constexpr bool IsFloat = false;
+    static constexpr float Scale = 32767.0f;
+};
+
+template<>
+struct SampleTraits<Int24> {
+    static constexpr SampleFormat Format = SAMPLE_INT24;
+    static constexpr unsigned int Bits = 24;
+    static constexpr bool IsFloat = false;
+    static constexpr float Scale = 8388607.0f;
+};
+
+template<>
+struct SampleTraits<int32_t> {
+    static constexpr SampleFormat Format = SAMPLE_INT32;
+    static constexpr unsigned int Bits = 32;
+    static constexpr bool IsFloat = false;
+    // 2^31 - 1 is not representable as a float, this is the largest float that still converts without overflow
+    static constexpr float Scale = 2147483520.0f;
+};
+
+template<>
+struct SampleTraits<float> {
+    static constexpr SampleFormat Format = SAMPLE_FLOAT32;
+    static constexpr unsigned int Bits = 32;
+    static constexpr bool IsFloat = true;
+    static constexpr float Scale = 1.0f;
+};
+
+// Triangular (TPDF) dither of one least significant bit, made from the difference of two uniform values.
+// Every SIMD lane has its own xorshift generator
+struct DitherState {
+    bool Enabled = false;
+    uint32_t Seeds[8] = {0x9E3779B9u, 0x7F4A7C15u, 0x85EBCA6Bu, 0xC2B2AE35u,
+                         0x27D4EB2Fu, 0x165667B1u, 0xD3A2646Cu, 0xFD7046C5u};
+};
+
+namespace SampleConversion {
+    inline uint32_t XorShift(uint32_t &state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Uniform value in [0, 1) built from the top 23 bits of a random number
+    inline float UniformFromBits(const uint32_t bits) {
+        const uint32_t oneToTwo = (bits >> 9) | 0x3F800000u;
+        float value;
+        std::memcpy(&value, &oneToTwo, sizeof(value));
+        return value - 1.0f;
+    }
+
+    inline float TriangularDither(DitherState &dither) {
+        return UniformFromBits(XorShift(dither.Seeds[0])) - UniformFromBits(XorShift(dither.Seeds[1]));
+    }
+
+    // NaN ends up as -1, the same as the SIMD min/max clamp
+    inline float ClampUnit(const float sample) {
+        return sample >= -1.0f ? (sample <= 1.0f ? sample : 1.0f) : -1.0f;
+    }
+
+    // Converts one already clamped sample, rounding to the nearest integer like the SIMD conversion does
+    template<class T>
+    inline void StoreSample(T *out, const float scaled) {
+        *out = static_cast<T>(std::nearbyint(scaled));
+    }
+
+    template<>
+    inline void StoreSample<Int24>(Int24 *out, const float scaled) {
+        const auto value = static_cast<int32_t>(std::nearbyint(scaled));
+        out->Bytes[0] = static_cast<uint8_t>(value & 0xFF);
+        out->Bytes[1] = static_cast<uint8_t>(value >> 8 & 0xFF);
+        out->Bytes[2] = static_cast<uint8_t>(value >> 16 & 0xFF);
+    }
+
+    template<>
+    inline void StoreSample<float>(float *out, const float scaled) {
+        *out = scaled;
+    }
+
+    template<class T>
+    inline void ConvertScalar(const float *in, T *out, const size_t count, DitherState &dither) {
+        constexpr float scale = SampleTraits<T>::Scale;
+        // the dither can push a full scale sample over the limit, so leave one bit of room
+        constexpr float limit = SampleTraits<T>::IsFloat ? 1.0f : scale - 1.0f;
+        const bool useDither = dither.Enabled && !SampleTraits<T>::IsFloat;
+
+        for (size_t n = 0; n < count; n++) {
+            float scaled = ClampUnit(in[n]) * scale;
+            if (useDither) {
+                scaled += TriangularDither(dither);
+                scaled = scaled > limit ? limit : scaled < -limit ? -limit : scaled;
+            }
+            StoreSample(out + n, scaled);
+        }
+    }
+
+#if MUVE_SIMD_AVX2
+    constexpr size_t VECTOR_WIDTH = 8;
+
+    inline __m256 TriangularDither8(__m256i &state) {
+        const __m256i one = _mm256_set1_epi32(0x3F800000);
+        __m256 uniform[2];
+        for (__m256 &value: uniform) {
+            state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+            state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+            state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+            value = _mm256_castsi256_ps(_mm256_or_si256(_mm256_srli_epi32(state, 9), one));
+        }
+        return _mm256_sub_ps(uniform[0], uniform[1]);
+    }
+
+    // Clamps, scales and dithers 8 samples, returning them rounded to integers
+    inline __m256i ScaleToInt8(const float *in, const float scale, const bool useDither, __m256i &seeds) {
+        __m256 value = _mm256_loadu_ps(in);
+        value = _mm256_min_ps(_mm256_max_ps(value, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+        value = _mm256_mul_ps(value, _mm256_set1_ps(scale));
+        if (useDither) {
+            value = _mm256_add_ps(value, TriangularDither8(seeds));
+            value = _mm256_min_ps(_mm256_max_ps(value, _mm256_set1_ps(1.0f - scale)), _mm256_set1_ps(scale - 1.0f));
+        }
+        return _mm256_cvtps_epi32(value);
+    }
+
+    template<class T>
+    inline size_t ConvertVector(const float *, T *, size_t, DitherState &) { return 0; }
+
+    template<>
+    inline size_t ConvertVector<int16_t>(const float *in, int16_t *out, const size_t count, DitherState &dither) {
+        __m256i seeds = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dither.Seeds));
+        size_t n = 0;
+        for (; n + 16 <= count; n += 16) {
+            const __m256i low = ScaleToInt8(in + n, SampleTraits<int16_t>::Scale, dither.Enabled, seeds);
+            const __m256i high = ScaleToInt8(in + n + 8, SampleTraits<int16_t>::Scale, dither.Enabled, seeds);
+            // packs works inside 128 bit lanes, the permute puts the samples back in order
+            const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high), 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + n), packed);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dither.Seeds), seeds);
+        return n;
+    }
+
+    template<>
+    inline size_t ConvertVector<int32_t>(const float *in, int32_t *out, const size_t count, DitherState &dither) {
+        __m256i seeds = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dither.Seeds));
+        size_t n = 0;
+        for (; n + 8 <= count; n += 8)
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + n),
+                                ScaleToInt8(in + n, SampleTraits<int32_t>::Scale, dither.Enabled, seeds));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dither.Seeds), seeds);
+        return n;
+    }
+
+    template<>
+    inline size_t ConvertVector<float>(const float *in, float *out, const size_t count, DitherState &) {
+        size_t n = 0;
+        for (; n + 8 <= count; n += 8) {
+            const __m256 value = _mm256_loadu_ps(in + n);
+            _mm256_storeu_ps(out + n, _mm256_min_ps(_mm256_max_ps(value, _mm256_set1_ps(-1.0f)),
+                                                    _mm256_set1_ps(1.0f)));
+        }
+        return n;
+    }
+#elif MUVE_SIMD_SSE2
+    constexpr size_t VECTOR_WIDTH = 4;
+
+    inline __m128 TriangularDither4(__m128i &state) {
+        const __m128i one = _mm_set1_epi32(0x3F800000);
+        __m128 uniform[2];
+        for (__m128 &value: uniform) {
+            state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+            state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+            state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+            value = _mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(state, 9), one));
+        }
+        return _mm_sub_ps(uniform[0], uniform[1]);
+    }
+
+    // Clamps, scales and dithers 4 samples, returning them rounded to integers
+    inline __m128i ScaleToInt4(const float *in, const float scale, const bool useDither, __m128i &seeds) {
+        __m128 value = _mm_loadu_ps(in);
+        value = _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+        value = _mm_mul_ps(value, _mm_set1_ps(scale));
+        if (useDither) {
+            value = _mm_add_ps(value, TriangularDither4(seeds));
+            value = _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(1.0f - scale)), _mm_set1_ps(scale - 1.0f));
+        }
+        return _mm_cvtps_epi32(value);
+    }
+
+    template<class T>
+    inline size_t ConvertVector(const float *, T *, size_t, DitherState &) { return 0; }
+
+    template<>
+    inline size_t ConvertVector<int16_t>(const float *in, int16_t *out, const size_t count, DitherState &dither) {
+        __m128i seeds = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dither.Seeds));
+        size_t n = 0;
+        for (; n + 8 <= count; n += 8) {
+            const __m128i low = ScaleToInt4(in + n, SampleTraits<int16_t>::Scale, dither.Enabled, seeds);
+            const __m128i high = ScaleToInt4(in + n + 4, SampleTraits<int16_t>::Scale, dither.Enabled, seeds);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + n), _mm_packs_epi32(low, high));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dither.Seeds), seeds);
+        return n;
+    }
+
+    template<>
+    inline size_t ConvertVector<int32_t>(const float *in, int32_t *out, const size_t count, DitherState &dither) {
+        __m128i seeds = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dither.Seeds));
+        size_t n = 0;
+        for (; n + 4 <= count; n += 4)
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + n),
+                             ScaleToInt4(in + n, SampleTraits<int32_t>::Scale, dither.Enabled, seeds));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dither.Seeds), seeds);
+        return n;
+    }
+
+    template<>
+    inline size_t ConvertVector<float>(const float *in, float *out, const size_t count, DitherState &) {
+        size_t n = 0;
+        for (; n + 4 <= count; n += 4) {
+            const __m128 value = _mm_loadu_ps(in + n);
+            _mm_storeu_ps(out + n, _mm_min_ps(_mm_max_ps(value, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f)));
+        }
+        return n;
+    }
+#else
+    constexpr size_t VECTOR_WIDTH = 1;
+
+    template<class T>
+    inline size_t ConvertVector(const float *, T *, size_t, DitherState &) { return 0; }
+#endif
+}
+
+// Converts a block of mixed samples in the range [-1, 1] to the output format.
+// Packed 24 bit samples and whatever is left after the last full vector go through the scalar path
+template<class T>
+inline void ConvertSamples(const float *in, T *out, const size_t count, DitherState &dither) {
+    const size_t converted = SampleConversion::ConvertVector<T>(in, out, count, dither);
+    SampleConversion::ConvertScalar<T>(in + converted, out + converted, count - converted, dither);
+}
+
+// Same as above for an output format picked at run time, 'out' has to hold 'count' samples of that format
+inline void ConvertSamples(const SampleFormat format, const float *in, void *out, const size_t count,
+                           DitherState &dither) {
+    switch (format) {
+        case SAMPLE_INT24:
+            ConvertSamples(in, static_cast<Int24 *>(out), count, dither);
+            break;
+        case SAMPLE_INT32:
+            ConvertSamples(in, static_cast<int32_t *>(out), count, dither);
+            break;
+        case SAMPLE_FLOAT32:
+            ConvertSamples(in, static_cast<float *>(out), count, dither);
+            break;
+        default:
+            ConvertSamples(in, static_cast<int16_t *>(out), count, dither);
+            break;
+    }
+}
+
+inline unsigned int SampleFormatBits(const SampleFormat format) {
+    switch (format) {
+        case SAMPLE_INT24:
+            return SampleTraits<Int24>::Bits;
+        case SAMPLE_INT32:
+            return SampleTraits<int32_t>::Bits;
+        case SAMPLE_FLOAT32:
+            return SampleTraits<float>::Bits;
+        default:
+            return SampleTraits<int16_t>::Bits;
+    }
+}
@@ -3,8 +3,24 @@
 //Might need to uncomment to run on Visual Studio
 //#pragma comment(lib,"ws2_32.lib")
 
+#ifdef _WIN32
 #include <WinSock2.h>
 #include <WS2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+// POSIX equivalents of the winsock names used bellow
+using SOCKET = int;
+using SOCKADDR_IN = sockaddr_in;
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int SOCKET_ERROR = -1;
+constexpr int SD_SEND = SHUT_WR;
+
+inline int closesocket(const SOCKET socket) { return close(socket); }
+#endif
 #include <iostream>
 #include <string>
 #include <cstring>
@@ -20,43 +36,49 @@ SocketServer::~SocketServer() {
 
     _ready = false;
     _clientThread.join();
-    WSACleanup();
+    CleanUp();
 }
 
 void SocketServer::StartServer() {
     SOCKET server;
     SOCKADDR_IN serverAddr;
+#ifdef _WIN32
     WSADATA wsaData;
 
     if (WSAStartup(MAKEWORD(2, 0), &wsaData) != NO_ERROR) {
         std::cout << "WSAStartup FAILED!";
         return;
     }
+#endif
 
     if ((server = socket(AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET) {
         std::cout << "socket() FAILED!\n";
-        WSACleanup();
+        CleanUp();
         return;
     }
 
     // optional but could set socket server options
-    ZeroMemory(&serverAddr, sizeof(serverAddr));
+    std::memset(&serverAddr, 0, sizeof(serverAddr));
     serverAddr.sin_family = AF_INET;
     //serverAddr.sin_addr.s_addr = /*INADDR_ANY; */ htonl(INADDR_ANY);
     serverAddr.sin_port = htons(PORT);
 
     // could try this instead for setting up the server address with the right IP
+#ifdef _WIN32
     InetPton(AF_INET, reinterpret_cast<LPCSTR>(L"10.72.95.19"), &serverAddr.sin_addr.s_addr);
+#else
+    inet_pton(AF_INET, "10.72.95.19", &serverAddr.sin_addr.s_addr);
+#endif
 
     if (bind(server, reinterpret_cast<sockaddr *>(&serverAddr), sizeof(serverAddr)) == SOCKET_ERROR) {
         std::cout << "bind() FAILED!\n";
-        WSACleanup();
+        CleanUp();
         return;
     }
 
     if (listen(server, 2) == SOCKET_ERROR) {
         std::cout << "listen() FAILED!\n";
-        WSACleanup();
+        CleanUp();
         return;
     }
 
@@ -71,7 +93,11 @@ void SocketServer::HandleClientMessages(int server) {
     while (_ready) {
         SOCKET client;
         SOCKADDR_IN clientAddr;
+#ifdef _WIN32
         int clientlength = sizeof(clientAddr);
+#else
+        socklen_t clientlength = sizeof(clientAddr);
+#endif
 
         std::cout << "Looking for Arduino device\n";
 
@@ -100,6 +126,12 @@ void SocketServer::HandleClientMessages(int server) {
     }
 }
 
+void SocketServer::CleanUp() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
 // Connection protocol, '#' signifies the beginning of a message and '|' signifies the end of a message
 // Example message: #5|#0|#2|#3|
 void SocketServer::BuildMessage(const char *message) {
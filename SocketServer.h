@@ -27,6 +27,8 @@ private:
 
     void HandleClientMessages(int server);
 
+    static void CleanUp();
+
     void BuildMessage(const char *message);
 
     int ProcessMessage(const int &messageValue) const;
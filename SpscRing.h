@@ -0,0 +1,139 @@
+/*
+	This file contains the lock-free hand-off used between an audio device callback and the render thread.
+	SpscRing is a wait-free single producer / single consumer ring, EventCount lets the consumer sleep
+	when the ring is empty, the producer only makes a system call when someone is actually sleeping
+*/
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+// Size of a cache line, indices written by different threads are kept apart to avoid false sharing
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Sleeping primitive with no lost wake ups: a waiter first takes a key, checks its condition and only then sleeps
+// on the key. Any Notify after PrepareWait makes Wait return
+class EventCount {
+public:
+    uint32_t PrepareWait() {
+        _waiters.fetch_add(1, std::memory_order_seq_cst);
+        return _epoch.load(std::memory_order_seq_cst);
+    }
+
+    void CancelWait() {
+        _waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void Wait(const uint32_t key) {
+        while (_epoch.load(std::memory_order_acquire) == key)
+            SleepOn(key);
+
+        _waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // Has to be called after the condition the waiter checks has been made true
+    void Notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_waiters.load(std::memory_order_relaxed) == 0)
+            return;
+
+        _epoch.fetch_add(1, std::memory_order_seq_cst);
+        WakeAll();
+    }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _epoch{};
+    std::atomic<uint32_t> _waiters{};
+
+#if defined(_WIN32)
+    void SleepOn(uint32_t key) { WaitOnAddress(&_epoch, &key, sizeof(key), INFINITE); }
+
+    void WakeAll() { WakeByAddressAll(&_epoch); }
+#elif defined(__linux__)
+    void SleepOn(const uint32_t key) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&_epoch), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+    }
+
+    void WakeAll() {
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&_epoch), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+    }
+#else
+    std::mutex _mutex;
+    std::condition_variable _condition;
+
+    void SleepOn(const uint32_t key) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condition.wait(lock, [this, key] { return _epoch.load(std::memory_order_acquire) != key; });
+    }
+
+    void WakeAll() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _condition.notify_all();
+    }
+#endif
+};
+
+// Fixed capacity ring, one thread pushes and one thread pops. Both sides are wait-free, the indices grow forever
+// and are masked into the storage, so the capacity is rounded up to a power of two
+template<class T>
+class SpscRing {
+public:
+    explicit SpscRing(const uint32_t capacity = 0) { Reset(capacity); }
+
+    // Not thread safe, only call while no other thread uses the ring
+    void Reset(const uint32_t capacity) {
+        uint32_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+
+        _items.assign(size, T{});
+        _mask = size - 1;
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer side
+    bool TryPush(const T &item) {
+        const uint32_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) > _mask)
+            return false;
+
+        _items[tail & _mask] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool TryPop(T &item) {
+        const uint32_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+
+        item = _items[head & _mask];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Can be read from any thread, it is only exact from the producer or consumer side
+    uint32_t Size() const {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _head{};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> _tail{};
+    alignas(CACHE_LINE_SIZE) std::vector<T> _items;
+    uint32_t _mask{};
+};
@@ -4,8 +4,15 @@
 */
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
 #include <map>
+#include <string>
 #include <utility>
+#include <vector>
+#include "Wavetables.h"
 //#include "StateMachine.h"
 
 namespace synth {
@@ -21,6 +28,10 @@ namespace synth {
     constexpr int OSC_SAW_ANALOG = 3;
     constexpr int OSC_SAW_DIGITAL = 4;
     constexpr int OSC_NOISE = 5;
+    // PolyBLEP versions, band-limited from the phase increment of the voice. Stateless callers get the plain wave
+    constexpr int OSC_SQUARE_BLEP = 6;
+    constexpr int OSC_TRIANGLE_BLEP = 7;
+    constexpr int OSC_SAW_BLEP = 8;
 
     std::map<char, int> NoteToScaleMap{
         {'A', 0},
@@ -57,11 +68,40 @@ namespace synth {
         return hertz * 2.0 * PI;
     }
 
+    // Scale positions covered by the pitch table, everything the instruments play with room to spare
+    constexpr int PITCH_TABLE_LOWEST = -128;
+    constexpr int PITCH_TABLE_SIZE = 256;
+
+    // Frequency of every scale position in the table range, worked out once
+    struct PitchTable {
+        double Hertz[PITCH_TABLE_SIZE];
+
+        PitchTable() {
+            for (int n = 0; n < PITCH_TABLE_SIZE; n++)
+                Hertz[n] = OCTIVE_BASE_FREQUENCY * std::pow(D12TH_ROOT_OF2, n + PITCH_TABLE_LOWEST + STARTING_HALF_STEP);
+        }
+
+        static const PitchTable &Get() {
+            static const PitchTable table;
+            return table;
+        }
+    };
+
     // Scale to Frequency conversion
     inline double ScaleToFrequency(const int &notePosition) {
+        const int index = notePosition - PITCH_TABLE_LOWEST;
+        if (index >= 0 && index < PITCH_TABLE_SIZE)
+            return PitchTable::Get().Hertz[index];
         return OCTIVE_BASE_FREQUENCY * std::pow(D12TH_ROOT_OF2, notePosition + STARTING_HALF_STEP);
     }
 
+    // Constant power pan law, pan goes from -1 (left) to 1 (right)
+    inline void PanToGains(const double &pan, double &left, double &right) {
+        const double angle = (std::min(std::max(pan, -1.0), 1.0) + 1.0) * PI / 4.0;
+        left = std::cos(angle);
+        right = std::sin(angle);
+    }
+
     // used for the A minor key
     inline int NegativeHarmonyTransformation(const int scaleNote) {
         const int basicNote = scaleNote % 12;
@@ -73,36 +113,372 @@ namespace synth {
         double Hertz;
     };
 
-    inline double Oscillator(const double &time, const double &hertz, const int &type = OSC_SINE,
-                             const LFO &fm = {0.0, 0.0}, const LFO &am = {0.0, 0.0}) {
-        const double freq = FrequencyToAngularVelocity(hertz) * time +
-                            fm.Amplitude * fm.Hertz * (std::sin(FrequencyToAngularVelocity(fm.Hertz) * time));
-
-        const double offset = 1 - am.Amplitude;
-        const double AM = offset + am.Amplitude * std::sin(FrequencyToAngularVelocity(am.Hertz) * time);
+    // Wave form at 'phase' (in cycles, from 0 to 1) of its period. 'phaseOffset' is the frequency modulation on
+    // top of it, in radians
+    inline double Waveform(const int &type, const double &phase, const double &phaseOffset) {
+        const double freq = 2.0 * PI * phase + phaseOffset;
 
         switch (type) {
             case OSC_SINE:
-                return std::sin(freq) * AM;
+                return std::sin(freq);
             case OSC_SQUARE:
-                return (std::sin(freq) > 0 ? 1.0 : -1.0) * AM;
+                return std::sin(freq) > 0 ? 1.0 : -1.0;
             case OSC_TRIANGLE:
-                return std::asin(std::sin(freq)) * (2.0 / PI) * AM;
+                return std::asin(std::sin(freq)) * (2.0 / PI);
             case OSC_SAW_ANALOG: {
                 double output = 0.0;
                 for (unsigned int n = 1; n < 50; n++)
                     output += (std::sin(n * freq) / n);
-                return output * (2.0 / PI) * AM;
+                return output * (2.0 / PI);
             }
             case OSC_SAW_DIGITAL: // has some problems when mixed with other waves
-                return (2.0 / PI) * (hertz * PI * std::fmod(time, 1.0 / hertz) - (PI / 2.0));
-            case OSC_NOISE:
-                return 2.0 * (static_cast<double>(std::rand()) / static_cast<double>(RAND_MAX)) - 1.0;
+                return 2.0 * phase - 1.0;
+            case OSC_NOISE: {
+                // voices have their own noise source, this one only serves the stateless callers
+                thread_local uint32_t state = 2463534242u;
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                return static_cast<double>(state >> 8) * (2.0 / 16777216.0) - 1.0;
+            }
+            case OSC_SQUARE_BLEP:
+                return phase < 0.5 ? 1.0 : -1.0;
+            case OSC_TRIANGLE_BLEP:
+                return phase < 0.25 ? 4.0 * phase : phase < 0.75 ? 2.0 - 4.0 * phase : 4.0 * phase - 4.0;
+            case OSC_SAW_BLEP:
+                return 1.0 - 2.0 * phase;
             default:
                 return 0.0;
         }
     }
 
+    // Polynomial correction of a unit step at phase 0, spread over the sample before and after it
+    inline double PolyBlep(double phase, const double &increment) {
+        if (phase < increment) {
+            phase /= increment;
+            return phase + phase - phase * phase - 1.0;
+        }
+        if (phase > 1.0 - increment) {
+            phase = (phase - 1.0) / increment;
+            return phase * phase + phase + phase + 1.0;
+        }
+        return 0.0;
+    }
+
+    // Same for a change of slope (a corner) at phase 0, integral of the step correction
+    inline double PolyBlamp(double phase, const double &increment) {
+        if (phase < increment) {
+            phase = phase / increment - 1.0;
+            return -1.0 / 3.0 * phase * phase * phase;
+        }
+        if (phase > 1.0 - increment) {
+            phase = (phase - 1.0) / increment + 1.0;
+            return 1.0 / 3.0 * phase * phase * phase;
+        }
+        return 0.0;
+    }
+
+    inline bool IsPolyBlep(const int &type) {
+        return type == OSC_SQUARE_BLEP || type == OSC_TRIANGLE_BLEP || type == OSC_SAW_BLEP;
+    }
+
+    inline double WrapPhase(const double &phase) {
+        return phase - std::floor(phase);
+    }
+
+    // The plain wave with its jumps and corners smoothed out, 'increment' is in cycles per sample. Same phase and
+    // level as OSC_SQUARE, OSC_TRIANGLE and OSC_SAW_ANALOG
+    inline double PolyBlepWaveform(const int &type, const double &phase, double increment) {
+        increment = std::min(std::fabs(increment), 0.5);
+        const double naive = Waveform(type, phase, 0.0);
+
+        switch (type) {
+            case OSC_SQUARE_BLEP:
+                return naive + PolyBlep(phase, increment) - PolyBlep(WrapPhase(phase + 0.5), increment);
+            case OSC_TRIANGLE_BLEP:
+                return naive + 4.0 * increment * (PolyBlamp(WrapPhase(phase + 0.25), increment) -
+                                                  PolyBlamp(WrapPhase(phase + 0.75), increment));
+            case OSC_SAW_BLEP:
+                return naive + PolyBlep(phase, increment);
+            default:
+                return naive;
+        }
+    }
+
+    // Band-limited table for the wave forms that have one, nullptr for the ones computed directly
+    inline const float *WaveformTable(const int &type, const double &increment) {
+        switch (type) {
+            case OSC_SQUARE:
+                return WavetableBank::Get().Select(WAVETABLE_SQUARE, increment);
+            case OSC_TRIANGLE:
+                return WavetableBank::Get().Select(WAVETABLE_TRIANGLE, increment);
+            case OSC_SAW_ANALOG:
+            case OSC_SAW_DIGITAL:
+                return WavetableBank::Get().Select(WAVETABLE_SAW, increment);
+            default:
+                return nullptr;
+        }
+    }
+
+    // Stateless oscillator, works everything out from the time. Voices use the phase accumulators of VoiceState
+    inline double Oscillator(const double &time, const double &hertz, const int &type = OSC_SINE,
+                             const LFO &fm = {0.0, 0.0}, const LFO &am = {0.0, 0.0}) {
+        const double phaseOffset = fm.Amplitude * fm.Hertz * (std::sin(FrequencyToAngularVelocity(fm.Hertz) * time));
+
+        const double offset = 1 - am.Amplitude;
+        const double AM = offset + am.Amplitude * std::sin(FrequencyToAngularVelocity(am.Hertz) * time);
+
+        const double cycles = hertz * time;
+        return Waveform(type, cycles - std::floor(cycles), phaseOffset) * AM;
+    }
+
+    // Sine LFO that rotates a unit vector one sample at a time, so it never calls sin while it runs
+    struct LFOState {
+        double Sin = 0.0;
+        double Cos = 1.0;
+        double StepSin = 0.0;
+        double StepCos = 1.0;
+
+        void Reset(const double &hertz, const double &sampleRate) {
+            const double step = FrequencyToAngularVelocity(hertz) / sampleRate;
+            Sin = 0.0;
+            Cos = 1.0;
+            StepSin = std::sin(step);
+            StepCos = std::cos(step);
+        }
+
+        // Value for the current sample, then moves on to the next one
+        double Next() {
+            const double value = Sin;
+            const double sin = Sin * StepCos + Cos * StepSin;
+            const double cos = Cos * StepCos - Sin * StepSin;
+
+            // pulls the vector back to unit length, rounding errors would otherwise grow over a long note
+            const double gain = 1.5 - 0.5 * (sin * sin + cos * cos);
+            Sin = sin * gain;
+            Cos = cos * gain;
+            return value;
+        }
+    };
+
+    constexpr unsigned int NOISE_LANES = 4;
+    constexpr unsigned int NOISE_BLOCK = 64; // noise samples a voice generates at once
+
+    // Xorshift noise with a few generators side by side, so a block is filled with vector instructions.
+    // Every voice has its own, seeded when the note starts, so the output does not depend on the render order
+    struct NoiseSource {
+        uint32_t Lanes[NOISE_LANES] = {1u, 2u, 3u, 4u};
+
+        void Seed(uint64_t seed) {
+            for (uint32_t &lane: Lanes) {
+                // splitmix64 spreads close seeds apart, xorshift must never start at 0
+                seed += 0x9E3779B97F4A7C15ull;
+                uint64_t z = seed;
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                lane = static_cast<uint32_t>(z ^ (z >> 31)) | 1u;
+            }
+        }
+
+        // Uniform values from -1 to 1, 'count' has to be a multiple of NOISE_LANES
+        void Fill(float *out, const unsigned int count) {
+            for (unsigned int n = 0; n < count; n += NOISE_LANES) {
+                for (unsigned int lane = 0; lane < NOISE_LANES; lane++) {
+                    uint32_t state = Lanes[lane];
+                    state ^= state << 13;
+                    state ^= state >> 17;
+                    state ^= state << 5;
+                    Lanes[lane] = state;
+                    out[n + lane] = static_cast<float>(state >> 8) * (2.0f / 16777216.0f) - 1.0f;
+                }
+            }
+        }
+    };
+
+    constexpr unsigned int MAX_PARTIALS = 8;
+    constexpr unsigned int VOICE_BLOCK_FRAMES = 32; // most frames a voice is rendered for at once
+
+    // One oscillator of a voice, the phase is kept in cycles so it never loses precision
+    struct Partial {
+        double Weight;
+        double Hertz;
+        double Phase;
+        double Increment; // cycles per sample
+        const float *Table; // band-limited table picked for the partial frequency, if the wave form has one
+        int Type;
+        bool UseFM;
+        bool UseAM;
+    };
+
+    // Everything a playing note needs from one sample to the next, set up once when the note starts
+    struct VoiceState {
+        Partial Partials[MAX_PARTIALS];
+        unsigned int PartialCount = 0;
+        double SampleRate = 44100.0;
+        LFOState FMState;
+        LFOState AMState;
+        double FMDepth = 0.0; // peak phase deviation, in radians
+        double AMDepth = 0.0;
+        NoiseSource Noise;
+        float NoiseBlock[NOISE_BLOCK];
+        unsigned int NoiseIndex = NOISE_BLOCK;
+        bool IsStarted = false;
+        // a voice playing a pre-rendered one-shot reads its samples from it, its partials are not used
+        const float *OneShot = nullptr;
+        unsigned int OneShotLength = 0;
+        unsigned int OneShotPosition = 0;
+        float FilterState[2] = {}; // integrators of the voice filter of the instrument, if it has one
+
+        void Start(const double &sampleRate, const LFO &fm, const LFO &am, const uint64_t noiseSeed = 0) {
+            SampleRate = sampleRate;
+            Noise.Seed(noiseSeed);
+            NoiseIndex = NOISE_BLOCK;
+            PartialCount = 0;
+            FMState.Reset(fm.Hertz, sampleRate);
+            AMState.Reset(am.Hertz, sampleRate);
+            FMDepth = fm.Amplitude * fm.Hertz;
+            AMDepth = am.Amplitude;
+            OneShot = nullptr;
+            OneShotLength = OneShotPosition = 0;
+            FilterState[0] = FilterState[1] = 0.0f;
+            IsStarted = true;
+        }
+
+        // Plays 'length' samples from the start of 'samples', then silence. The samples are not copied
+        void PlayOneShot(const float *samples, const unsigned int length) {
+            OneShot = samples;
+            OneShotLength = length;
+            OneShotPosition = 0;
+        }
+
+        bool HasSound() const { return PartialCount > 0 || OneShot != nullptr; }
+
+        // Partials past MAX_PARTIALS are dropped
+        void AddPartial(const double &weight, const double &hertz, const int &type = OSC_SINE,
+                        const bool useFM = false, const bool useAM = false) {
+            if (PartialCount == MAX_PARTIALS)
+                return;
+
+            const double increment = hertz / SampleRate;
+            Partials[PartialCount++] = {
+                weight, hertz, 0.0, increment, WaveformTable(type, increment), type, useFM, useAM
+            };
+        }
+
+        // Sum of the partials for the current sample, then every phase moves on by one sample
+        double Next() {
+            if (OneShot != nullptr)
+                return OneShotPosition < OneShotLength ? OneShot[OneShotPosition++] : 0.0;
+
+            const double phaseOffset = FMDepth * FMState.Next();
+            const double AM = 1.0 - AMDepth + AMDepth * AMState.Next();
+            double output = 0.0;
+
+            const double phaseOffsetCycles = phaseOffset / (2.0 * PI);
+
+            for (unsigned int n = 0; n < PartialCount; n++) {
+                Partial &partial = Partials[n];
+                const double phase = partial.UseFM ? WrapPhase(partial.Phase + phaseOffsetCycles) : partial.Phase;
+                double wave;
+                if (partial.Table != nullptr) {
+                    wave = WavetableLookup(partial.Table, phase);
+                    // the digital saw rises where the analog one falls
+                    if (partial.Type == OSC_SAW_DIGITAL)
+                        wave = -wave;
+                } else if (IsPolyBlep(partial.Type)) {
+                    wave = PolyBlepWaveform(partial.Type, phase, partial.Increment);
+                } else if (partial.Type == OSC_NOISE) {
+                    wave = NextNoise();
+                } else {
+                    wave = Waveform(partial.Type, partial.Phase, partial.UseFM ? phaseOffset : 0.0);
+                }
+                output += partial.Weight * (partial.UseAM ? wave * AM : wave);
+
+                partial.Phase += partial.Increment;
+                partial.Phase -= std::floor(partial.Phase);
+            }
+
+            return output;
+        }
+
+        // Same as calling Next() 'frames' times, no more than VOICE_BLOCK_FRAMES. The modulation is worked out
+        // first, then every partial runs its own loop with no branches on the wave form inside it
+        void Render(float *out, const unsigned int frames) {
+            if (OneShot != nullptr) {
+                for (unsigned int n = 0; n < frames; n++)
+                    out[n] = OneShotPosition < OneShotLength ? OneShot[OneShotPosition++] : 0.0f;
+                return;
+            }
+
+            double phaseOffset[VOICE_BLOCK_FRAMES];
+            double AM[VOICE_BLOCK_FRAMES];
+            double sum[VOICE_BLOCK_FRAMES] = {};
+            for (unsigned int n = 0; n < frames; n++) {
+                phaseOffset[n] = FMDepth * FMState.Next();
+                AM[n] = 1.0 - AMDepth + AMDepth * AMState.Next();
+            }
+
+            for (unsigned int p = 0; p < PartialCount; p++) {
+                Partial &partial = Partials[p];
+                const double fm = partial.UseFM ? 1.0 / (2.0 * PI) : 0.0;
+                double wave[VOICE_BLOCK_FRAMES];
+
+                if (partial.Table != nullptr) {
+                    // the digital saw rises where the analog one falls
+                    const double sign = partial.Type == OSC_SAW_DIGITAL ? -1.0 : 1.0;
+                    for (unsigned int n = 0; n < frames; n++)
+                        wave[n] = sign * WavetableLookup(partial.Table,
+                                                         WrapPhase(partial.Phase + n * partial.Increment +
+                                                                   phaseOffset[n] * fm));
+                } else if (IsPolyBlep(partial.Type)) {
+                    for (unsigned int n = 0; n < frames; n++)
+                        wave[n] = PolyBlepWaveform(partial.Type,
+                                                   WrapPhase(partial.Phase + n * partial.Increment +
+                                                             phaseOffset[n] * fm), partial.Increment);
+                } else if (partial.Type == OSC_NOISE) {
+                    for (unsigned int n = 0; n < frames; n++)
+                        wave[n] = NextNoise();
+                } else {
+                    for (unsigned int n = 0; n < frames; n++)
+                        wave[n] = Waveform(partial.Type, WrapPhase(partial.Phase + n * partial.Increment),
+                                           partial.UseFM ? phaseOffset[n] : 0.0);
+                }
+
+                if (partial.UseAM)
+                    for (unsigned int n = 0; n < frames; n++)
+                        sum[n] += partial.Weight * wave[n] * AM[n];
+                else
+                    for (unsigned int n = 0; n < frames; n++)
+                        sum[n] += partial.Weight * wave[n];
+
+                partial.Phase = WrapPhase(partial.Phase + frames * partial.Increment);
+            }
+
+            for (unsigned int n = 0; n < frames; n++)
+                out[n] = static_cast<float>(sum[n]);
+        }
+
+        double NextNoise() {
+            if (NoiseIndex == NOISE_BLOCK) {
+                Noise.Fill(NoiseBlock, NOISE_BLOCK);
+                NoiseIndex = 0;
+            }
+            return NoiseBlock[NoiseIndex++];
+        }
+
+        // Stateless sum of the partials 'time' seconds into the note
+        double At(const double &time, const LFO &fm, const LFO &am) const {
+            double output = 0.0;
+            for (unsigned int n = 0; n < PartialCount; n++) {
+                const Partial &partial = Partials[n];
+                output += partial.Weight * Oscillator(time, partial.Hertz, partial.Type,
+                                                      partial.UseFM ? fm : LFO{0.0, 0.0},
+                                                      partial.UseAM ? am : LFO{0.0, 0.0});
+            }
+            return output;
+        }
+    };
+
     struct Envelope {
         virtual ~Envelope() = default;
 
@@ -120,8 +496,8 @@ namespace synth {
             StartAmplitude(startAmplitude) {
         };
 
-        // TODO: try to fix bug where playing the note again does a click sound.. might be happening because of
-        //sudden change change in sound
+        // Stateless, the amplitude is worked out from the times alone. Playing notes use an EnvelopeState instead,
+        // which also retriggers from its current level without a click
         double Amplitude(const double &time, const double &timeOn, const double &timeOff) override {
             double amplitude = 0.0;
 
@@ -165,30 +541,226 @@ namespace synth {
         }
     };
 
+    constexpr int ENVELOPE_ATTACK = 0;
+    constexpr int ENVELOPE_DECAY = 1;
+    constexpr int ENVELOPE_SUSTAIN = 2;
+    constexpr int ENVELOPE_RELEASE = 3;
+    constexpr int ENVELOPE_FINISHED = 4;
+
+    // ADSR envelope of one voice, it moves on a number of frames at a time. Every stage is a straight line, so it
+    // only keeps the level, what to add to it per frame and how many frames are left before the next stage
+    struct EnvelopeState {
+        int Stage = ENVELOPE_FINISHED;
+        double Level = 0.0;
+        double Increment = 0.0; // added to the level every frame
+        uint64_t StageFrames = 0; // frames left in the stage
+        uint64_t LifeFrames = UINT64_MAX; // frames left before the note life time ends
+
+        // Starts the attack from the current level, so a note played again while it still sounds does not click
+        void Trigger(const EnvolopeADSR &env, const double &sampleRate, const double &maxLifeTime) {
+            _startAmplitude = env.StartAmplitude;
+            _sustainAmplitude = env.SustainAmplitude;
+            _attackFrames = static_cast<uint64_t>(std::llround(std::max(env.AttackTime, 0.0) * sampleRate));
+            _decayFrames = static_cast<uint64_t>(std::llround(std::max(env.DecayTime, 0.0) * sampleRate));
+            _releaseFrames = static_cast<uint64_t>(std::llround(std::max(env.ReleaseTime, 0.0) * sampleRate));
+            LifeFrames = maxLifeTime > 0.0 ? static_cast<uint64_t>(std::ceil(maxLifeTime * sampleRate)) : UINT64_MAX;
+            if (Stage == ENVELOPE_FINISHED)
+                Level = 0.0;
+
+            // the attack keeps its slope, the closer the level already is the shorter it gets
+            uint64_t attackFrames = _attackFrames;
+            if (_startAmplitude > 0.0)
+                attackFrames = static_cast<uint64_t>(
+                    std::llround(_attackFrames * std::max(1.0 - Level / _startAmplitude, 0.0)));
+            Enter(ENVELOPE_ATTACK, attackFrames, _startAmplitude);
+        }
+
+        // Ramps down from the current level, a silent note finishes right away
+        void Release() {
+            if (Stage >= ENVELOPE_RELEASE)
+                return;
+            if (Level <= 0.001)
+                Finish();
+            else
+                Enter(ENVELOPE_RELEASE, _releaseFrames, 0.0);
+        }
+
+        bool IsReleased() const { return Stage >= ENVELOPE_RELEASE; }
+        bool IsFinished() const { return Stage == ENVELOPE_FINISHED; }
+
+        // Frames the envelope stays a straight line for
+        uint64_t FramesToNextStage() const { return std::min(StageFrames, LifeFrames); }
+
+        // Moves on 'frames' frames, no more than FramesToNextStage
+        void Advance(const uint64_t frames) {
+            if (Stage == ENVELOPE_FINISHED)
+                return;
+
+            Level += Increment * static_cast<double>(frames);
+            LifeFrames -= std::min(frames, LifeFrames);
+            if (StageFrames != UINT64_MAX)
+                StageFrames -= std::min(frames, StageFrames);
+
+            if (LifeFrames == 0)
+                Finish();
+            else if (StageFrames == 0)
+                NextStage();
+        }
+
+    private:
+        double _startAmplitude = 1.0;
+        double _sustainAmplitude = 1.0;
+        double _target = 0.0;
+        uint64_t _attackFrames = 0;
+        uint64_t _decayFrames = 0;
+        uint64_t _releaseFrames = 0;
+
+        void Enter(const int stage, const uint64_t frames, const double &target) {
+            Stage = stage;
+            _target = target;
+            StageFrames = frames;
+            if (frames == 0)
+                NextStage();
+            else
+                Increment = (target - Level) / static_cast<double>(frames);
+        }
+
+        // The level lands exactly on the target of the stage that ended, rounding errors never build up
+        void NextStage() {
+            Level = _target;
+            Increment = 0.0;
+            if (Stage == ENVELOPE_ATTACK) {
+                Enter(ENVELOPE_DECAY, _decayFrames, _sustainAmplitude);
+            } else if (Stage == ENVELOPE_DECAY) {
+                Stage = ENVELOPE_SUSTAIN;
+                StageFrames = UINT64_MAX;
+            } else {
+                Finish();
+            }
+        }
+
+        void Finish() {
+            Stage = ENVELOPE_FINISHED;
+            Level = 0.0;
+            Increment = 0.0;
+            StageFrames = UINT64_MAX;
+        }
+    };
+
+    // Mixer buses an instrument can play on
+    constexpr int BUS_DRUMS = 0;
+    constexpr int BUS_CHORDS = 1;
+    constexpr int BUS_BASS = 2;
+    constexpr int BUS_USER = 3;
+    constexpr int BUS_COUNT = 4;
+
+    // Bus from its name (drums, chords, bass or user), -1 if there is no such bus
+    inline int ParseBus(const std::string &name) {
+        static const char *names[BUS_COUNT] = {"drums", "chords", "bass", "user"};
+        for (int bus = 0; bus < BUS_COUNT; bus++)
+            if (name == names[bus])
+                return bus;
+        return -1;
+    }
+
+    // A voice handed to an instrument for one block, with its gains (envelope, volume and pan) at both ends of it
+    struct BlockVoice {
+        VoiceState *Voice;
+        double Gain0[2];
+        double Gain1[2];
+    };
+
+    struct VoiceSpan {
+        const BlockVoice *Voices;
+        unsigned int Count;
+    };
+
     struct InstrumentBase {
         virtual ~InstrumentBase() = default;
 
         double Volume{};
+        double Pan{}; // stereo position, from -1 (left) to 1 (right)
         EnvolopeADSR Env;
         LFO FM{}; // Note Frequency modulation (used to give a vibrato effect)
         LFO AM{}; // Note Amplitude modulation ( used to give a tremolo effect)
-        double MaxLifeTime = -1.0;
+        double MaxLifeTime = -1.0; // notes with a life time end after it, the others when their release is over
+        unsigned int MaxVoices = 0; // notes the instrument can hold at once, 0 for no limit. 1 makes it monophonic
+        int Bus = BUS_USER; // mixer bus the notes are played on
+        uint64_t NoiseSeed = 0; // mixed into the noise of every note, so instruments never share their noise
+        bool HasVoiceFilter = false; // every voice runs through a filter, so its partials never go into engine lanes
+
+        // Adds the partials of a new note to its voice
+        virtual void NoteOn(VoiceState &voice, const int &scalePos) = 0;
+
+        // Envelope of a note with the volume applied, 0 once the note has finished
+        double VoiceAmplitude(const double &time, const double &timeOn, const double &timeOff,
+                              bool &noteFinished) {
+            if (MaxLifeTime > 0.0 && time - timeOn >= MaxLifeTime) {
+                noteFinished = true;
+                return 0.0;
+            }
+
+            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
+            if (MaxLifeTime <= 0.0 && amplitude <= 0.0) {
+                noteFinished = timeOff > timeOn; // only finish playing if note is release phase and amplitude is 0
+                return 0.0;
+            }
+
+            return amplitude * Volume;
+        }
+
+        // Next sample of a voice, before the envelope. Only instruments that work one sample at a time override it
+        virtual double NextSample(VoiceState &voice) {
+            return voice.Next();
+        }
+
+        // Adds a block of every voice in 'voices', all of them played by this instrument, to 'left' and to 'right'
+        // unless it is nullptr. The gains are ramped over the block. This one asks NextSample for every sample,
+        // instruments that can do a whole block at once override it
+        virtual void RenderBlock(const VoiceSpan &voices, float *left, float *right, const unsigned int frames) {
+            for (unsigned int v = 0; v < voices.Count; v++) {
+                const BlockVoice &voice = voices.Voices[v];
+                const double stepLeft = (voice.Gain1[0] - voice.Gain0[0]) / frames;
+                const double stepRight = (voice.Gain1[1] - voice.Gain0[1]) / frames;
+                for (unsigned int n = 0; n < frames; n++) {
+                    const double sample = NextSample(*voice.Voice);
+                    left[n] += static_cast<float>(sample * (voice.Gain0[0] + stepLeft * n));
+                    if (right != nullptr)
+                        right[n] += static_cast<float>(sample * (voice.Gain0[1] + stepRight * n));
+                }
+            }
+        }
+
+        // Stateless version for callers that only have the note times, the voice is rebuilt on every call
+        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
+                     bool &noteFinished) {
+            const double amplitude = VoiceAmplitude(time, timeOn, timeOff, noteFinished);
+            if (amplitude <= 0.0)
+                return 0.0;
 
-        virtual double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                             bool &noteFinished) = 0;
+            VoiceState voice;
+            NoteOn(voice, scalePos);
+            return amplitude * voice.At(time - timeOn, FM, AM);
+        }
     };
 
-    // Basic note
+    // Basic note, its start and release are frame indices of the output stream so it starts on the exact sample
     struct Note {
         int ScalePosition; // Position in the scale
-        double OnTime; // Time that note was activated
-        double OffTime; // Time that note was deactivated
+        uint64_t OnFrame; // Frame that note was activated
+        uint64_t OffFrame; // Frame that note was deactivated, the note is released while it is after OnFrame
         bool IsActive;
         InstrumentBase *Channel; // might need to delete the pointer in a destructor
-
-        explicit Note(int pos = 0, double on = 0.0, double off = 0.0, bool active = false,
-                      InstrumentBase *channel = nullptr) : ScalePosition(pos), OnTime(on), OffTime(off),
+        VoiceState Voice; // oscillator state, set up by the instrument on the first frame of the note
+        double PanGains[2]; // left and right output gains, taken from the instrument pan when the note starts
+        int EngineVoice = -1; // voice in the VoiceEngine holding the sine partials, -1 if it is not in one
+        EnvelopeState Envelope;
+        uint64_t TriggerFrame = 0; // OnFrame the envelope was last triggered for
+
+        explicit Note(int pos = 0, uint64_t on = 0, uint64_t off = 0, bool active = false,
+                      InstrumentBase *channel = nullptr) : ScalePosition(pos), OnFrame(on), OffFrame(off),
                                                            IsActive(active), Channel(channel) {
+            PanToGains(Channel != nullptr ? Channel->Pan : 0.0, PanGains[0], PanGains[1]);
             /*std::cout << "Harmonic strcture:\n";
             std::cout << ScaleToFrequency(ScalePosition) << std::endl;
             std::cout << 2 * ScaleToFrequency(ScalePosition) << std::endl;
@@ -200,16 +772,29 @@ namespace synth {
             std::cout << 8 * ScaleToFrequency(ScalePosition) << std::endl;*/
         }
 
-        double Sound(const double &time) {
-            double noise = 0.0;
-            bool isNoteFinished = false;
+        bool IsReleased() const { return OffFrame > OnFrame; }
 
-            if (Channel != nullptr)
-                noise = Channel->Sound(time, OnTime, OffTime, ScalePosition, isNoteFinished);
+        // A release can be set before it happens, the envelope only sees it from its frame on
+        bool IsReleasedBy(const uint64_t frame) const { return IsReleased() && frame >= OffFrame; }
 
-            IsActive = !isNoteFinished;
+        // Sets up the voice, on the first frame the note plays
+        void Start(const double &timeStep) {
+            // the noise of a note only depends on the instrument and when and what it plays
+            Voice.Start(1.0 / timeStep, Channel->FM, Channel->AM,
+                        Channel->NoiseSeed ^ OnFrame * 0x100000001B3ull ^ static_cast<uint64_t>(ScalePosition + 1024));
+            Channel->NoteOn(Voice, ScalePosition);
+            Envelope.Trigger(Channel->Env, 1.0 / timeStep, Channel->MaxLifeTime);
+            TriggerFrame = OnFrame;
+        }
 
-            return noise;
+        // Retriggers or releases the envelope if the note was played again or released by 'frame'
+        void UpdateEnvelope(const uint64_t frame, const double &timeStep) {
+            if (TriggerFrame != OnFrame) {
+                Envelope.Trigger(Channel->Env, 1.0 / timeStep, Channel->MaxLifeTime);
+                TriggerFrame = OnFrame;
+            }
+            if (IsReleasedBy(frame))
+                Envelope.Release();
         }
     };
 
@@ -225,14 +810,15 @@ namespace synth {
         };
 
         double BeatTime;
-        double Accumulate;
+        uint64_t StartFrame; // frame of the first beat
+        uint64_t BeatCount; // beats scheduled so far
+        bool IsStarted;
         int CurrentBeat;
         int TotalBeats;
 
         void (*EndOffSequenceCallBack)(Sequencer *);
 
-        //TODO: convert these into a dictionary, if we want an instrument to only be able to play one note at a time
-        // if this is made some changes would also need to happen on the application.cpp file
+        // an instrument that should only play one note at a time sets MaxVoices to 1, the voice pool does the rest
         std::vector<Channel> Channels;
         std::vector<Note> Notes;
 
@@ -241,24 +827,39 @@ namespace synth {
             BeatTime = (60.0f / tempo) / static_cast<float>(subBeats);
             CurrentBeat = 0;
             TotalBeats = subBeats * beats;
-            Accumulate = 0;
+            StartFrame = 0;
+            BeatCount = 0;
+            IsStarted = false;
             EndOffSequenceCallBack = func;
         }
 
-        unsigned int Update(const double &deltaTime, const double &currentTime) {
+        // Schedules every beat that starts before 'untilFrame'. Beat frames are worked out from the beat count, so
+        // they never drift from the tempo, and the notes start on those frames even when they are handed over early
+        unsigned int Update(const uint64_t currentFrame, const uint64_t untilFrame, const double &sampleRate) {
             Notes.clear();
 
-            Accumulate += deltaTime;
-            while (Accumulate >= BeatTime) {
+            if (!IsStarted) {
+                StartFrame = currentFrame;
+                IsStarted = true;
+            }
+
+            const double beatFrames = BeatTime * sampleRate;
+            uint64_t beatFrame = StartFrame + static_cast<uint64_t>(std::llround(BeatCount * beatFrames));
+            while (beatFrame < untilFrame) {
                 for (Channel channel: Channels) {
                     if (channel.BeatSequence[CurrentBeat] != '.') {
+                        // instruments that sustain are released after one step, they would never end otherwise
+                        const uint64_t offFrame = channel.Instrument->MaxLifeTime > 0.0
+                                                      ? 0
+                                                      : beatFrame + static_cast<uint64_t>(beatFrames);
                         Note newNote(NoteToScaleMap[channel.BeatSequence[CurrentBeat]],
-                                     currentTime, 0.0, false, channel.Instrument);
+                                     beatFrame, offFrame, true, channel.Instrument);
                         Notes.emplace_back(newNote);
                     }
                 }
 
-                Accumulate -= BeatTime;
+                BeatCount++;
+                beatFrame = StartFrame + static_cast<uint64_t>(std::llround(BeatCount * beatFrames));
                 CurrentBeat++;
                 CurrentBeat %= TotalBeats;
 
@@ -284,6 +885,50 @@ namespace synth {
         }
     };
 
+    constexpr unsigned int CONTROL_BLOCK_FRAMES = 32; // frames between two control rate updates of a parameter
+
+    // A value set by the control side (sensors, the UI) that the audio follows in a straight line instead of
+    // jumping to it. The first value set is taken on the spot
+    struct SmoothedParameter {
+        // Heads to 'target', reaching it 'frames' frames from now
+        void SetTarget(const double target, const unsigned int frames) {
+            if (!_isSet || frames == 0) {
+                _current = target;
+                _remaining = 0;
+                _isSet = true;
+            } else if (target != _target) {
+                _step = (target - _current) / frames;
+                _remaining = frames;
+            }
+            _target = target;
+        }
+
+        double Current() const { return _current; }
+        double Target() const { return _target; }
+        bool IsRamping() const { return _remaining > 0; }
+
+        // Moves 'frames' frames along the ramp and returns the value there
+        double Advance(const unsigned int frames = 1) {
+            if (_remaining == 0)
+                return _current;
+            if (frames >= _remaining) {
+                _current = _target;
+                _remaining = 0;
+            } else {
+                _current += _step * frames;
+                _remaining -= frames;
+            }
+            return _current;
+        }
+
+    private:
+        double _current = 0.0;
+        double _target = 0.0;
+        double _step = 0.0;
+        unsigned int _remaining = 0;
+        bool _isSet = false;
+    };
+
     struct Filter {
         virtual ~Filter() = default;
 
@@ -332,569 +977,4 @@ namespace synth {
             return Output;
         }
     };
-
-    // Bellow is the list of created instruments
-    // Bellow instruments are meant to be used by the user only
-    struct KeyboardInstrument : public InstrumentBase {
-        KeyboardInstrument() {
-            FM = {1.5, 1.5};
-            AM = {0.3, 3.0};
-            Env.ReleaseTime = 0.1;
-            Volume = 0.6;
-
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 0.1;
-            Env.SustainAmplitude = 0.65;
-        };
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            if (amplitude <= 0.0) {
-                noteFinished = timeOff > timeOn; // only finish playing if note is release phase and amplitude is 0
-                return 0.0;
-            }
-
-            const double lifeTime = time - timeOn;
-            //int scaleTest = scalePos - 12;
-            //int waveForm = OSC_SINE;
-            /*double sound = 1 * Oscillator(lifeTime, ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.3 * Oscillator(lifeTime, 2 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.35 * Oscillator(lifeTime, 3 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.35 * Oscillator(lifeTime, 4 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.3 * Oscillator(lifeTime, 5 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.31 * Oscillator(lifeTime, 6 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.32 * Oscillator(lifeTime, 7 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.25 * Oscillator(lifeTime, 8 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.0 * Oscillator(lifeTime, 9 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                0.6 * Oscillator(lifeTime, 10 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.0 * Oscillator(lifeTime, 11 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.1 * Oscillator(lifeTime, 12 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.2 * Oscillator(lifeTime, 13 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1.25 * Oscillator(lifeTime, 14 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                1 * Oscillator(lifeTime, 15 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                0.6 * Oscillator(lifeTime, 16 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                0.5 * Oscillator(lifeTime, 17 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                0.45 * Oscillator(lifeTime, 18 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                0.4 * Oscillator(lifeTime, 19 * ScaleToFrequency(scaleTest), waveForm, FM) +
-                0.35 * Oscillator(lifeTime, 20 * ScaleToFrequency(scaleTest), waveForm, FM);*/
-            const double sound = 2 * Oscillator(lifeTime, ScaleToFrequency(scalePos - 24), OSC_SINE, FM, AM)
-                                 + 0.5 * Oscillator(lifeTime, ScaleToFrequency(scalePos + 24), OSC_SINE, FM, AM)
-                                 + 0.5 * Oscillator(lifeTime, ScaleToFrequency(scalePos), OSC_SINE, FM, AM);
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentBell : public InstrumentBase {
-        InstrumentBell() {
-            FM = {5.0, 0.001};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 1.0;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 1.0;
-            Volume = 0.7;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            if (amplitude <= 0.0) {
-                noteFinished = timeOff > timeOn;
-                return 0.0;
-            }
-
-            const double lifeTime = time - timeOn;
-            const double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(scalePos + 12), OSC_SINE, FM)
-                                 + 0.5 * Oscillator(lifeTime, ScaleToFrequency(scalePos + 24))
-                                 + 0.25 * Oscillator(lifeTime, ScaleToFrequency(scalePos + 36));
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentBell8 : public InstrumentBase {
-        InstrumentBell8() {
-            FM = {5.0, 0.001};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 0.5;
-            Env.SustainAmplitude = 0.8;
-            Env.ReleaseTime = 1.0;
-            Volume = 0.35;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            if (amplitude <= 0.0) {
-                noteFinished = timeOff > timeOn;
-                return 0.0;
-            }
-
-            const double lifeTime = time - timeOn;
-            const double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(scalePos), OSC_SQUARE, FM)
-                                 + 0.5 * Oscillator(lifeTime, ScaleToFrequency(scalePos + 12))
-                                 + 0.25 * Oscillator(lifeTime, ScaleToFrequency(scalePos + 24));
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentHarmonica : public InstrumentBase {
-        InstrumentHarmonica() {
-            FM = {5.0, 0.001};
-            Env.AttackTime = 0.05;
-            Env.DecayTime = 1.0;
-            Env.SustainAmplitude = 0.95;
-            Env.ReleaseTime = 0.1;
-            Volume = 0.22;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            if (amplitude <= 0.0) {
-                noteFinished = timeOff > timeOn;
-                return 0.0;
-            }
-
-            const double lifeTime = time - timeOn;
-            const double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(scalePos - 12), OSC_SAW_ANALOG, FM)
-                                 + 1.0 * Oscillator(lifeTime, ScaleToFrequency(scalePos), OSC_SQUARE, FM)
-                                 + 0.5 * Oscillator(lifeTime, ScaleToFrequency(scalePos + 12), OSC_SQUARE)
-                                 + 0.25 * Oscillator(lifeTime, ScaleToFrequency(0), OSC_NOISE);
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    // Bellow instruments are meant to be used by the sequencer only
-    // TODO: consider passing in a life time so that a note can play use its sustain and release time
-    struct InstrumentDrumKick : public InstrumentBase {
-        InstrumentDrumKick() {
-            /*FM = { 1.0, 2.0 };
-            AM = { 0.2, 2 };*/
-            FM = {0.0, 0.0};
-            AM = {0.0, 0};
-            Env.AttackTime = 0.001;
-            Env.DecayTime = 0.5;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            //Volume = 0.5;
-            // volume for presentation
-            Volume = 1.0;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-            const double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(-STARTING_HALF_STEP + 12), OSC_SINE, FM,
-                                                  AM)
-                                 +
-                                 0.8 * Oscillator(lifeTime, 2 * ScaleToFrequency(-STARTING_HALF_STEP + 12), OSC_SINE,
-                                                  FM, AM)
-                                 /*+ 0.6 * Oscillator(lifeTime, 3 * ScaleToFrequency(-STARTING_HALF_STEP + 12), OSC_SINE, FM, AM)
-                           + 0.5 * Oscillator(lifeTime, 4 * ScaleToFrequency(-STARTING_HALF_STEP + 12), OSC_SINE, FM, AM)
-                           + 0.3 * Oscillator(lifeTime, 5 * ScaleToFrequency(-STARTING_HALF_STEP + 12), OSC_SINE, FM, AM)*/
-                                 + 0.01 * Oscillator(lifeTime, ScaleToFrequency(0), OSC_NOISE);
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentDrumSnare : public InstrumentBase {
-        InstrumentDrumSnare() {
-            FM = {0.5, 1.0};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 0.6;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            //Volume = 0.05;
-            //volume for presentation
-            Volume = 0.15;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-            const double sound = 0.5 * Oscillator(lifeTime, ScaleToFrequency(scalePos - 24), OSC_SINE, FM)
-                                 + 0.5 * Oscillator(lifeTime, ScaleToFrequency(0), OSC_NOISE);
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentDrumHihat : public InstrumentBase {
-        InstrumentDrumHihat() {
-            FM = {1.5, 1.0};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 0.05;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            //Volume = 0.02;
-            // volume for presentation
-            Volume = 0.1;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-            const double sound = 0.1 * Oscillator(lifeTime, ScaleToFrequency(scalePos - 12), OSC_SQUARE, FM)
-                                 + 0.9 * Oscillator(lifeTime, ScaleToFrequency(0), OSC_NOISE);
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentUserSensor : public InstrumentBase {
-        InstrumentUserSensor() {
-            //FM = { 2.0, 1.0 };
-            //AM = { 0.5, 4 };
-            FM = {1.5, 1.5};
-            AM = {0.3, 3.0};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 0.5;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            Volume = 1.3;
-            // volume for presentation
-            //Volume = 0.15;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-
-            //double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(scalePos - 12), OSC_SINE, FM)
-            //	+ 0.5 * Oscillator(lifeTime, ScaleToFrequency(scalePos), OSC_SINE)
-            //	+ 0.25 * Oscillator(lifeTime, ScaleToFrequency(scalePos - 24), OSC_SINE);
-            const double sound = 1 * Oscillator(lifeTime, ScaleToFrequency(scalePos - 24), OSC_SINE, FM, AM)
-                                 + 0.5 * Oscillator(lifeTime, ScaleToFrequency(scalePos + 24), OSC_SINE, FM, AM)
-                                 + 0.5 * Oscillator(lifeTime, ScaleToFrequency(scalePos), OSC_SINE, FM, AM);
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentCordPlayer : public InstrumentBase {
-        InstrumentCordPlayer() {
-            FM = {1.0, 1.0};
-            AM = {0.5, 4};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 1.1;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            Volume = 0.5;
-            // volume for presentation
-            //Volume = 0.15;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-
-            const int cordRoot = scalePos - 12;
-            const double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(cordRoot), OSC_SINE, FM)
-                                 + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 7), OSC_SINE, FM)
-                                 + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 12), OSC_SINE, FM)
-                                 + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 15), OSC_SINE, FM)
-                                 + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 19), OSC_SINE, FM)
-                    //+ 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 22), OSC_SINE, FM)
-                    ;
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentCordBase : public InstrumentBase {
-        InstrumentCordBase() {
-            FM = {0.8, 0.8};
-            AM = {0.0, 0.0};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 2.0;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            Volume = 0.3;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-
-            const int cordRoot = scalePos - 24;
-            const double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(cordRoot), OSC_SINE, FM, AM)
-                                 + 0.5 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 12), OSC_SINE, FM, AM)
-                                 + 0.2 * Oscillator(lifeTime, 3 * ScaleToFrequency(cordRoot), OSC_SINE)
-                                 + 0.05 * Oscillator(lifeTime, 5 * ScaleToFrequency(cordRoot), OSC_SINE);
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentCordDiminished : public InstrumentBase {
-        InstrumentCordDiminished() {
-            FM = {1.0, 1.0};
-            AM = {0.5, 4};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 1.1;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            Volume = 0.5;
-            // volume for presentation
-            //Volume = 0.15;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-
-            const int cordRoot = scalePos - 12;
-
-            // first diminished
-            const double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(cordRoot), OSC_SINE, FM)
-                                 + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 6), OSC_SINE, FM)
-                                 + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 12), OSC_SINE, FM)
-                                 + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 15), OSC_SINE, FM)
-                                 + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 18), OSC_SINE, FM)
-                    //+ 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 21), OSC_SINE, FM)
-                    ;
-
-            //double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(cordRoot +1), OSC_SINE, FM)
-            //	+ 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 7), OSC_SINE, FM)
-            //	+ 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 13), OSC_SINE, FM)
-            //	+ 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 16), OSC_SINE, FM)
-            //	+ 1.4 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 22), OSC_SINE, FM);
-
-            /*double sound = 1.0 * Oscillator(lifeTime, ScaleToFrequency(cordRoot+2), OSC_SINE, FM)
-                + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 8), OSC_SINE, FM)
-                + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 14), OSC_SINE, FM)
-                + 1 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 17), OSC_SINE, FM)
-                + 1.4 * Oscillator(lifeTime, ScaleToFrequency(cordRoot + 23), OSC_SINE, FM);*/
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentCordInversion : public InstrumentBase {
-        InstrumentCordInversion() {
-            FM = {1.0, 1.0};
-            AM = {0.5, 4};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 1.1;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            Volume = 0.5;
-            // volume for presentation
-            //Volume = 0.15;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-
-            //int cordRoot = scalePos - 12;
-            // chord inversion
-            const double sound = 1.0 * Oscillator(
-                                     lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(scalePos) - 12),
-                                     OSC_SINE, FM)
-                                 + 1 *
-                                 Oscillator(lifeTime,
-                                            ScaleToFrequency(NegativeHarmonyTransformation(scalePos + 7) - 12),
-                                            OSC_SINE, FM)
-                                 + 1 *
-                                 Oscillator(lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(scalePos)),
-                                            OSC_SINE,
-                                            FM)
-                                 + 1 * Oscillator(
-                                     lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(scalePos + 3)),
-                                     OSC_SINE, FM)
-                                 + 1 * Oscillator(
-                                     lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(scalePos + 7)),
-                                     OSC_SINE, FM)
-                    //+ 1 * Oscillator(lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(cordRoot + 22)), OSC_SINE, FM)
-                    ;
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentCordBaseInverted : public InstrumentBase {
-        InstrumentCordBaseInverted() {
-            FM = {0.8, 0.8};
-            AM = {0.0, 0.0};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 2.0;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            Volume = 0.3;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-
-            //int cordRoot = scalePos - 24;
-            const double sound = 1.0 * Oscillator(
-                                     lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(scalePos) - 24),
-                                     OSC_SINE, FM, AM)
-                                 + 0.5 * Oscillator(
-                                     lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(scalePos) - 12),
-                                     OSC_SINE, FM, AM)
-                                 + 0.2 *
-                                 Oscillator(lifeTime,
-                                            3 * ScaleToFrequency(NegativeHarmonyTransformation(scalePos) - 24),
-                                            OSC_SINE)
-                                 + 0.05 *
-                                 Oscillator(lifeTime,
-                                            5 * ScaleToFrequency(NegativeHarmonyTransformation(scalePos) - 24),
-                                            OSC_SINE);
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentUserSensorInversion : public InstrumentBase {
-        InstrumentUserSensorInversion() {
-            FM = {1.5, 1.5};
-            AM = {0.3, 3.0};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 0.5;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            Volume = 1.3;
-            // volume for presentation
-            //Volume = 0.15;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-
-            const double sound = 1 * Oscillator(
-                                     lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(scalePos) - 24),
-                                     OSC_SINE, FM, AM)
-                                 + 0.5 * Oscillator(
-                                     lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(scalePos) + 24),
-                                     OSC_SINE, FM, AM)
-                                 + 0.5 *
-                                 Oscillator(lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(scalePos)),
-                                            OSC_SINE,
-                                            FM, AM);
-
-            return amplitude * sound * Volume;
-        }
-    };
-
-    struct InstrumentUserSensorDiminished : public InstrumentBase {
-        InstrumentUserSensorDiminished() {
-            FM = {1.5, 1.5};
-            AM = {0.3, 3.0};
-            Env.AttackTime = 0.01;
-            Env.DecayTime = 0.5;
-            Env.SustainAmplitude = 0.0;
-            Env.ReleaseTime = 0.0;
-            MaxLifeTime = Env.AttackTime + Env.DecayTime;
-            Volume = 1.3;
-            // volume for presentation
-            //Volume = 0.15;
-        }
-
-        double Sound(const double &time, const double &timeOn, const double &timeOff, const int &scalePos,
-                     bool &noteFinished) override {
-            if (time - timeOn >= MaxLifeTime) {
-                noteFinished = true;
-                return 0.0;
-            }
-
-            const double amplitude = Env.Amplitude(time, timeOn, timeOff);
-            const double lifeTime = time - timeOn;
-
-            int diminishedNote = scalePos;
-            if (scalePos == 7 || scalePos == 8 || scalePos == 10)
-                diminishedNote--;
-
-            const double sound = 1 *
-                                 Oscillator(lifeTime, ScaleToFrequency(
-                                                NegativeHarmonyTransformation(diminishedNote) - 24),
-                                            OSC_SINE, FM, AM)
-                                 + 0.5 *
-                                 Oscillator(lifeTime, ScaleToFrequency(
-                                                NegativeHarmonyTransformation(diminishedNote) + 24),
-                                            OSC_SINE, FM, AM)
-                                 + 0.5 * Oscillator(
-                                     lifeTime, ScaleToFrequency(NegativeHarmonyTransformation(diminishedNote)),
-                                     OSC_SINE, FM, AM);
-
-            return amplitude * sound * Volume;
-        }
-    };
 }
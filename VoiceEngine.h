@@ -0,0 +1,398 @@
+/*
+	This file contains the voice engine, it renders the playing notes a block at a time.
+	The sine partials of every voice are kept side by side in arrays (one "lane" each), and a group of 4 or 8 lanes
+	is rendered per instruction: the oscillators, their FM and AM and the envelope ramps.
+	Partials of any other wave form stay on the voice, each instrument renders them for all of its notes at once
+*/
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "LaneVector.h"
+#include "SynthUtils.h"
+#include "VoicePool.h"
+
+namespace synth {
+    constexpr unsigned int ENGINE_BUS_LANES = 512; // lanes each mixer bus has, a multiple of every vector width
+    constexpr unsigned int ENGINE_MAX_LANES = ENGINE_BUS_LANES * BUS_COUNT;
+    constexpr unsigned int ENGINE_MAX_VOICES = 256;
+    // longest span rendered at once, spans also end where a note starts, is released or changes envelope stage
+    constexpr unsigned int ENGINE_SUB_BLOCK = VOICE_BLOCK_FRAMES;
+
+    // sin(2 pi x) for any x, good to about 4e-6. The phase is folded into a quarter period and a 9th order
+    // polynomial does the rest, so there are no branches
+    inline LaneVector SinCycles(const LaneVector x) {
+        const LaneVector r = x - Round(x);
+        const LaneVector t = Max(Min(r, LaneVector::Set(0.5f) - r), LaneVector::Set(-0.5f) - r);
+        const LaneVector t2 = t * t;
+
+        constexpr double TAU = 2.0 * PI;
+        LaneVector p = LaneVector::Set(static_cast<float>(TAU * TAU * TAU * TAU * TAU * TAU * TAU * TAU * TAU / 362880.0));
+        p = p * t2 + LaneVector::Set(static_cast<float>(-TAU * TAU * TAU * TAU * TAU * TAU * TAU / 5040.0));
+        p = p * t2 + LaneVector::Set(static_cast<float>(TAU * TAU * TAU * TAU * TAU / 120.0));
+        p = p * t2 + LaneVector::Set(static_cast<float>(-TAU * TAU * TAU / 6.0));
+        p = p * t2 + LaneVector::Set(static_cast<float>(TAU));
+        return p * t;
+    }
+
+    class VoiceEngine {
+    public:
+        VoiceEngine() {
+            for (unsigned int n = 0; n < ENGINE_MAX_VOICES; n++)
+                _freeVoices[n] = ENGINE_MAX_VOICES - 1 - n;
+            _freeVoiceCount = ENGINE_MAX_VOICES;
+        }
+
+        // Reserves the note tables for the 'notes' the voice pool can hold, called before the audio starts so that
+        // rendering never allocates
+        void Prepare(const unsigned int notes) {
+            _order.reserve(notes);
+            _blockVoices.reserve(notes);
+        }
+
+        unsigned int LaneCount() const {
+            unsigned int count = 0;
+            for (const unsigned int lanes: _laneCount)
+                count += lanes;
+            return count;
+        }
+
+        // Moves the sine partials of a voice into lanes, returns the engine voice or -1 when the engine is full or
+        // the voice has no sines. Partials that were not moved stay on the voice. 'fm' and 'am' are the LFOs the
+        // voice was started with, every mixer bus has its own lanes
+        int AddVoice(VoiceState &voice, const LFO &fm, const LFO &am, const int bus) {
+            unsigned int sines = 0;
+            for (unsigned int n = 0; n < voice.PartialCount; n++)
+                sines += voice.Partials[n].Type == OSC_SINE;
+            if (sines == 0 || _freeVoiceCount == 0 || bus < 0 || bus >= BUS_COUNT ||
+                _laneCount[bus] + sines > ENGINE_BUS_LANES)
+                return -1;
+
+            const int slot = static_cast<int>(_freeVoices[--_freeVoiceCount]);
+            _voiceGains[slot] = VoiceGains{};
+            _busOfVoice[slot] = bus;
+
+            unsigned int kept = 0;
+            for (unsigned int n = 0; n < voice.PartialCount; n++) {
+                const Partial &partial = voice.Partials[n];
+                if (partial.Type != OSC_SINE) {
+                    voice.Partials[kept++] = partial;
+                    continue;
+                }
+
+                const unsigned int lane = bus * ENGINE_BUS_LANES + _laneCount[bus]++;
+                _voiceOfLane[lane] = slot;
+                _weight[lane] = static_cast<float>(partial.Weight);
+                _phase[lane] = static_cast<float>(partial.Phase);
+                _increment[lane] = static_cast<float>(partial.Increment);
+                _fmPhase[lane] = 0.0f;
+                _fmIncrement[lane] = static_cast<float>(fm.Hertz / voice.SampleRate);
+                _fmDepth[lane] = partial.UseFM ? static_cast<float>(voice.FMDepth / (2.0 * PI)) : 0.0f;
+                _amPhase[lane] = 0.0f;
+                _amIncrement[lane] = static_cast<float>(am.Hertz / voice.SampleRate);
+                _amDepth[lane] = partial.UseAM ? static_cast<float>(voice.AMDepth) : 0.0f;
+            }
+            voice.PartialCount = kept;
+
+            return slot;
+        }
+
+        void RemoveVoice(const int slot) {
+            if (slot < 0)
+                return;
+
+            // the last lane of the bus takes the place of each removed one, lane order does not matter
+            const int bus = _busOfVoice[slot];
+            const unsigned int first = bus * ENGINE_BUS_LANES;
+            for (unsigned int lane = first; lane < first + _laneCount[bus];) {
+                if (_voiceOfLane[lane] == slot)
+                    MoveLane(first + --_laneCount[bus], lane);
+                else
+                    lane++;
+            }
+            _freeVoices[_freeVoiceCount++] = static_cast<unsigned int>(slot);
+        }
+
+        // Gains of a voice at the start and at the end of the next rendered span, envelope and pan included
+        void SetVoiceGains(const int slot, const float left0, const float left1, const float right0,
+                           const float right1) {
+            _voiceGains[slot] = {left0, left1, right0, right1};
+        }
+
+        // Adds 'frames' samples of the lanes of every bus to its 'left' buffer, and to its 'right' buffer unless
+        // 'right' is nullptr
+        void Render(float *const *left, float *const *right, const unsigned int frames) {
+            for (int bus = 0; bus < BUS_COUNT; bus++)
+                RenderLanes(bus * ENGINE_BUS_LANES, _laneCount[bus], left[bus], right != nullptr ? right[bus] : nullptr,
+                            frames);
+        }
+
+        // Adds 'frames' samples of 'count' lanes from 'first' to 'left', and to 'right' unless it is nullptr
+        void RenderLanes(const unsigned int first, const unsigned int count, float *left, float *right,
+                         const unsigned int frames) {
+            if (count == 0 || frames == 0)
+                return;
+
+            constexpr unsigned int W = LaneVector::WIDTH;
+            const unsigned int groups = (count + W - 1) / W;
+            const float inverseFrames = 1.0f / static_cast<float>(frames);
+
+            // lanes past the last one in the final group are rendered too, silently
+            for (unsigned int lane = first; lane < first + groups * W; lane++) {
+                if (lane >= first + count) {
+                    _gainLeft[lane] = _gainLeftStep[lane] = _gainRight[lane] = _gainRightStep[lane] = 0.0f;
+                    continue;
+                }
+                const VoiceGains &gains = _voiceGains[_voiceOfLane[lane]];
+                _gainLeft[lane] = gains.Left0 * _weight[lane];
+                _gainLeftStep[lane] = (gains.Left1 - gains.Left0) * _weight[lane] * inverseFrames;
+                _gainRight[lane] = gains.Right0 * _weight[lane];
+                _gainRightStep[lane] = (gains.Right1 - gains.Right0) * _weight[lane] * inverseFrames;
+            }
+
+            std::fill(_accumulateLeft, _accumulateLeft + frames * W, 0.0f);
+            if (right != nullptr)
+                std::fill(_accumulateRight, _accumulateRight + frames * W, 0.0f);
+
+            const LaneVector one = LaneVector::Set(1.0f);
+            for (unsigned int group = 0; group < groups; group++) {
+                const unsigned int l = first + group * W;
+                LaneVector phase = LaneVector::Load(_phase + l);
+                const LaneVector increment = LaneVector::Load(_increment + l);
+                LaneVector fmPhase = LaneVector::Load(_fmPhase + l);
+                const LaneVector fmIncrement = LaneVector::Load(_fmIncrement + l);
+                const LaneVector fmDepth = LaneVector::Load(_fmDepth + l);
+                LaneVector amPhase = LaneVector::Load(_amPhase + l);
+                const LaneVector amIncrement = LaneVector::Load(_amIncrement + l);
+                const LaneVector amDepth = LaneVector::Load(_amDepth + l);
+                LaneVector gainLeft = LaneVector::Load(_gainLeft + l);
+                const LaneVector gainLeftStep = LaneVector::Load(_gainLeftStep + l);
+                LaneVector gainRight = LaneVector::Load(_gainRight + l);
+                const LaneVector gainRightStep = LaneVector::Load(_gainRightStep + l);
+
+                for (unsigned int n = 0; n < frames; n++) {
+                    const LaneVector am = one - amDepth + amDepth * SinCycles(amPhase);
+                    const LaneVector wave = SinCycles(phase + fmDepth * SinCycles(fmPhase)) * am;
+
+                    (LaneVector::Load(_accumulateLeft + n * W) + wave * gainLeft).Store(_accumulateLeft + n * W);
+                    if (right != nullptr)
+                        (LaneVector::Load(_accumulateRight + n * W) + wave * gainRight).Store(
+                            _accumulateRight + n * W);
+
+                    gainLeft = gainLeft + gainLeftStep;
+                    gainRight = gainRight + gainRightStep;
+                    phase = phase + increment;
+                    phase = phase - Round(phase);
+                    fmPhase = fmPhase + fmIncrement;
+                    fmPhase = fmPhase - Round(fmPhase);
+                    amPhase = amPhase + amIncrement;
+                    amPhase = amPhase - Round(amPhase);
+                }
+
+                phase.Store(_phase + l);
+                fmPhase.Store(_fmPhase + l);
+                amPhase.Store(_amPhase + l);
+            }
+
+            for (unsigned int n = 0; n < frames; n++) {
+                left[n] += Sum(_accumulateLeft + n * W);
+                if (right != nullptr)
+                    right[n] += Sum(_accumulateRight + n * W);
+            }
+        }
+
+        // Renders 'frames' frames of every note into the 'left' and 'right' buffers of its instrument bus ('right'
+        // is nullptr for a mono mix, which gets the plain voices). Notes start and release on their exact frame,
+        // the spans are split at those frames and at the envelope stages
+        void RenderNotes(VoicePool &notes, float *const *left, float *const *right, const uint32_t frames,
+                         const uint64_t startFrame, const double &timeStep) {
+            int retired;
+            while (notes.TakeRetiredEngineVoice(retired))
+                RemoveVoice(retired);
+
+            // the notes of each instrument are rendered together, in one call to the instrument
+            _order.resize(notes.Count());
+            for (unsigned int n = 0; n < notes.Count(); n++)
+                _order[n] = n;
+            std::sort(_order.begin(), _order.end(), [&notes](const unsigned int a, const unsigned int b) {
+                return std::less<const InstrumentBase *>()(notes[a].Channel, notes[b].Channel);
+            });
+            _blockVoices.resize(notes.Count());
+
+            uint64_t spanStart = startFrame;
+            const uint64_t endFrame = startFrame + frames;
+
+            while (spanStart < endFrame) {
+                uint64_t spanEnd = std::min<uint64_t>(spanStart + ENGINE_SUB_BLOCK, endFrame);
+                for (unsigned int n = 0; n < notes.Count(); n++) {
+                    Note &note = notes[n];
+                    if (note.Channel == nullptr)
+                        continue;
+                    if (note.OnFrame > spanStart) {
+                        spanEnd = std::min(spanEnd, note.OnFrame);
+                        continue;
+                    }
+
+                    StartNote(note, spanStart, timeStep);
+                    if (note.IsReleased() && note.OffFrame > spanStart)
+                        spanEnd = std::min(spanEnd, note.OffFrame);
+                    // a span never crosses a corner of an envelope, so the gain ramps follow it exactly
+                    if (!note.Envelope.IsFinished() && note.Envelope.FramesToNextStage() < spanEnd - spanStart)
+                        spanEnd = spanStart + note.Envelope.FramesToNextStage();
+                }
+
+                const auto spanFrames = static_cast<unsigned int>(spanEnd - spanStart);
+                float *spanLeft[BUS_COUNT];
+                float *spanRight[BUS_COUNT];
+                for (int bus = 0; bus < BUS_COUNT; bus++) {
+                    spanLeft[bus] = left[bus] + (spanStart - startFrame);
+                    spanRight[bus] = right != nullptr ? right[bus] + (spanStart - startFrame) : nullptr;
+                }
+
+                RenderSpan(notes, spanLeft, right != nullptr ? spanRight : nullptr, spanStart, spanFrames);
+                Render(spanLeft, right != nullptr ? spanRight : nullptr, spanFrames);
+
+                spanStart = spanEnd;
+            }
+
+            // finished notes give their slot and their lanes back
+            for (unsigned int n = 0; n < notes.Count();) {
+                if (notes[n].IsActive) {
+                    n++;
+                    continue;
+                }
+                if (notes[n].EngineVoice >= 0) {
+                    RemoveVoice(notes[n].EngineVoice);
+                    notes[n].EngineVoice = -1;
+                }
+                notes.Release(n);
+            }
+        }
+
+    private:
+        struct VoiceGains {
+            float Left0, Left1, Right0, Right1;
+        };
+
+        unsigned int _laneCount[BUS_COUNT]{};
+        int _voiceOfLane[ENGINE_MAX_LANES]{};
+        float _weight[ENGINE_MAX_LANES]{};
+        float _phase[ENGINE_MAX_LANES]{};
+        float _increment[ENGINE_MAX_LANES]{};
+        float _fmPhase[ENGINE_MAX_LANES]{};
+        float _fmIncrement[ENGINE_MAX_LANES]{};
+        float _fmDepth[ENGINE_MAX_LANES]{};
+        float _amPhase[ENGINE_MAX_LANES]{};
+        float _amIncrement[ENGINE_MAX_LANES]{};
+        float _amDepth[ENGINE_MAX_LANES]{};
+        float _gainLeft[ENGINE_MAX_LANES]{};
+        float _gainLeftStep[ENGINE_MAX_LANES]{};
+        float _gainRight[ENGINE_MAX_LANES]{};
+        float _gainRightStep[ENGINE_MAX_LANES]{};
+
+        VoiceGains _voiceGains[ENGINE_MAX_VOICES]{};
+        int _busOfVoice[ENGINE_MAX_VOICES]{};
+        unsigned int _freeVoices[ENGINE_MAX_VOICES]{};
+        unsigned int _freeVoiceCount = 0;
+
+        std::vector<unsigned int> _order; // notes sorted by instrument
+        std::vector<BlockVoice> _blockVoices;
+
+        float _accumulateLeft[ENGINE_SUB_BLOCK * LaneVector::WIDTH]{};
+        float _accumulateRight[ENGINE_SUB_BLOCK * LaneVector::WIDTH]{};
+
+        static float Sum(const float *lanes) {
+            float sum = 0.0f;
+            for (unsigned int n = 0; n < LaneVector::WIDTH; n++)
+                sum += lanes[n];
+            return sum;
+        }
+
+        void MoveLane(const unsigned int from, const unsigned int to) {
+            _voiceOfLane[to] = _voiceOfLane[from];
+            _weight[to] = _weight[from];
+            _phase[to] = _phase[from];
+            _increment[to] = _increment[from];
+            _fmPhase[to] = _fmPhase[from];
+            _fmIncrement[to] = _fmIncrement[from];
+            _fmDepth[to] = _fmDepth[from];
+            _amPhase[to] = _amPhase[from];
+            _amIncrement[to] = _amIncrement[from];
+            _amDepth[to] = _amDepth[from];
+        }
+
+        // Sets up the voice of a note on its first frame, and follows it being played again or released
+        void StartNote(Note &note, const uint64_t frame, const double &timeStep) {
+            if (!note.Voice.IsStarted) {
+                note.Start(timeStep);
+                // a filtered voice is rendered whole by its instrument
+                note.EngineVoice = note.Channel->HasVoiceFilter
+                                       ? -1
+                                       : AddVoice(note.Voice, note.Channel->FM, note.Channel->AM, BusOf(*note.Channel));
+            }
+            note.UpdateEnvelope(frame, timeStep);
+        }
+
+        // Moves the envelope of every note over the next span and sets the gains of its lanes. The partials that
+        // are not in lanes are handed to their instrument, one call for all the notes it plays
+        void RenderSpan(VoicePool &notes, float *const *left, float *const *right, const uint64_t spanStart,
+                        const unsigned int frames) {
+            unsigned int groupStart = 0;
+            unsigned int voiceCount = 0;
+            InstrumentBase *instrument = nullptr;
+
+            for (const unsigned int index: _order) {
+                Note &note = notes[index];
+                if (note.Channel != instrument) {
+                    if (voiceCount > groupStart)
+                        RenderInstrument(*instrument, groupStart, voiceCount, left, right, frames);
+                    groupStart = voiceCount;
+                    instrument = note.Channel;
+                }
+                if (note.Channel == nullptr)
+                    continue;
+                if (spanStart < note.OnFrame) {
+                    // a note played again later than now is silent until then
+                    if (note.EngineVoice >= 0)
+                        SetVoiceGains(note.EngineVoice, 0.0f, 0.0f, 0.0f, 0.0f);
+                    continue;
+                }
+
+                const double amplitude0 = note.Envelope.Level * note.Channel->Volume;
+                note.Envelope.Advance(frames);
+                const double amplitude1 = note.Envelope.Level * note.Channel->Volume;
+                note.IsActive = !note.Envelope.IsFinished();
+
+                const double panLeft = right != nullptr ? note.PanGains[0] : 1.0;
+                const double panRight = right != nullptr ? note.PanGains[1] : 0.0;
+                if (note.EngineVoice >= 0)
+                    SetVoiceGains(note.EngineVoice, static_cast<float>(amplitude0 * panLeft),
+                                  static_cast<float>(amplitude1 * panLeft), static_cast<float>(amplitude0 * panRight),
+                                  static_cast<float>(amplitude1 * panRight));
+
+                if ((amplitude0 > 0.0 || amplitude1 > 0.0) && note.Voice.HasSound())
+                    _blockVoices[voiceCount++] = {
+                        &note.Voice, {amplitude0 * panLeft, amplitude0 * panRight},
+                        {amplitude1 * panLeft, amplitude1 * panRight}
+                    };
+            }
+
+            if (voiceCount > groupStart)
+                RenderInstrument(*instrument, groupStart, voiceCount, left, right, frames);
+        }
+
+        void RenderInstrument(InstrumentBase &instrument, const unsigned int first, const unsigned int end,
+                              float *const *left, float *const *right, const unsigned int frames) {
+            const int bus = BusOf(instrument);
+            instrument.RenderBlock({&_blockVoices[first], end - first}, left[bus],
+                                   right != nullptr ? right[bus] : nullptr, frames);
+        }
+
+        // instruments with a bus out of range play on the user bus
+        static int BusOf(const InstrumentBase &instrument) {
+            return instrument.Bus >= 0 && instrument.Bus < BUS_COUNT ? instrument.Bus : BUS_USER;
+        }
+    };
+}
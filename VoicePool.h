@@ -0,0 +1,143 @@
+/*
+	This file contains the voice pool, the fixed set of notes that can play at the same time.
+	Every note slot is allocated once, taking and giving back a slot is a push or a pop on a free list.
+	When the pool is full, or an instrument plays more notes than it is allowed to, a playing note is stolen
+*/
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+#include "SynthUtils.h"
+
+namespace synth {
+    constexpr int STEAL_OLDEST = 0; // the note that started first
+    constexpr int STEAL_QUIETEST = 1; // the note with the lowest envelope level
+
+    class VoicePool {
+    public:
+        explicit VoicePool(const unsigned int capacity) : _slots(capacity) {
+            _active.reserve(capacity);
+            _free.reserve(capacity);
+            _retiredEngineVoices.reserve(capacity);
+            for (unsigned int n = capacity; n > 0; n--)
+                _free.push_back(n - 1);
+        }
+
+        unsigned int Capacity() const { return static_cast<unsigned int>(_slots.size()); }
+        unsigned int Count() const { return static_cast<unsigned int>(_active.size()); }
+        uint64_t StolenVoices() const { return _stolenVoices; }
+
+        int StealMode = STEAL_QUIETEST;
+
+        // Playing notes, in no particular order. Releasing one moves the last note to its index
+        Note &operator[](const unsigned int index) { return _slots[_active[index]]; }
+
+        // Adds a note, nullptr only if the pool has no slots at all. When the instrument already holds as many
+        // notes as it may, one of them is released on the frame the new note starts. When the pool is full a
+        // note is taken over on the spot, released notes are picked before held ones
+        Note *Allocate(const Note &note) {
+            if (_slots.empty())
+                return nullptr;
+
+            if (note.Channel != nullptr && note.Channel->MaxVoices > 0) {
+                unsigned int held = 0;
+                for (const unsigned int slot: _active)
+                    held += IsHeldAt(_slots[slot], note.Channel, note.OnFrame);
+
+                if (held >= note.Channel->MaxVoices) {
+                    Note *victim = Pick(note.Channel, note.OnFrame);
+                    victim->OffFrame = std::max(note.OnFrame, victim->OnFrame + 1);
+                    _stolenVoices++;
+                }
+            }
+
+            if (_free.empty()) {
+                Note *victim = Pick(nullptr, note.OnFrame);
+                if (victim->EngineVoice >= 0)
+                    _retiredEngineVoices.push_back(victim->EngineVoice);
+                *victim = note;
+                _stolenVoices++;
+                return victim;
+            }
+
+            const unsigned int slot = _free.back();
+            _free.pop_back();
+            _active.push_back(slot);
+            _slots[slot] = note;
+            return &_slots[slot];
+        }
+
+        // Gives the slot of a finished note back
+        void Release(const unsigned int index) {
+            const unsigned int slot = _active[index];
+            if (_slots[slot].EngineVoice >= 0)
+                _retiredEngineVoices.push_back(_slots[slot].EngineVoice);
+            _slots[slot].EngineVoice = -1;
+
+            _active[index] = _active.back();
+            _active.pop_back();
+            _free.push_back(slot);
+        }
+
+        // First playing note the predicate accepts, nullptr if there is none
+        template<typename Predicate>
+        Note *Find(Predicate predicate) {
+            for (const unsigned int slot: _active)
+                if (predicate(_slots[slot]))
+                    return &_slots[slot];
+            return nullptr;
+        }
+
+        // Engine voices of the notes that were released or stolen, the voice engine frees them before rendering
+        bool TakeRetiredEngineVoice(int &voice) {
+            if (_retiredEngineVoices.empty())
+                return false;
+            voice = _retiredEngineVoices.back();
+            _retiredEngineVoices.pop_back();
+            return true;
+        }
+
+    private:
+        std::vector<Note> _slots;
+        std::vector<unsigned int> _active; // slots in use
+        std::vector<unsigned int> _free;
+        std::vector<int> _retiredEngineVoices;
+        uint64_t _stolenVoices = 0;
+
+        // A note of 'instrument' that is still held when 'frame' is played
+        static bool IsHeldAt(const Note &note, const InstrumentBase *instrument, const uint64_t frame) {
+            return note.Channel == instrument && note.IsActive && !(note.IsReleased() && note.OffFrame <= frame);
+        }
+
+        // Note to steal, from 'instrument' only unless it is nullptr. Notes already released go first
+        Note *Pick(const InstrumentBase *instrument, const uint64_t frame) {
+            Note *victim = nullptr;
+            bool victimHeld = true;
+            double victimScore = DBL_MAX;
+
+            for (const unsigned int slot: _active) {
+                Note &note = _slots[slot];
+                const bool held = IsHeldAt(note, note.Channel, frame);
+                if (instrument != nullptr && (note.Channel != instrument || !held))
+                    continue;
+
+                double score;
+                if (StealMode == STEAL_OLDEST)
+                    score = static_cast<double>(note.OnFrame);
+                else if (note.Voice.IsStarted && note.Channel != nullptr)
+                    score = note.Envelope.Level * note.Channel->Volume;
+                else
+                    score = DBL_MAX; // a note that has not started yet is about to be at its loudest
+
+                if (victim == nullptr || (victimHeld && !held) || (held == victimHeld && score < victimScore)) {
+                    victim = &note;
+                    victimHeld = held;
+                    victimScore = score;
+                }
+            }
+            return victim;
+        }
+    };
+}
@@ -0,0 +1,100 @@
+/*
+	This file contains the band-limited wave tables used by the voices for saw, square and triangle waves.
+	Every wave has one table per octave, each one holding only the harmonics that stay under the Nyquist frequency
+	for the notes it is picked for, so the waves do not alias
+*/
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace synth {
+    constexpr unsigned int WAVETABLE_SIZE = 2048; // a power of two, the lookups wrap with a mask
+    // octave 0 is for notes close to Nyquist (a single harmonic), every octave after it doubles the harmonics
+    constexpr unsigned int WAVETABLE_OCTAVES = 11;
+    constexpr unsigned int WAVETABLE_MAX_HARMONIC = WAVETABLE_SIZE / 2 - 1;
+
+    constexpr int WAVETABLE_SAW = 0;
+    constexpr int WAVETABLE_SQUARE = 1;
+    constexpr int WAVETABLE_TRIANGLE = 2;
+    constexpr int WAVETABLE_SHAPES = 3;
+
+    class WavetableBank {
+    public:
+        // Built on the first call, which should happen at startup rather than on the render thread
+        static const WavetableBank &Get() {
+            static const WavetableBank bank;
+            return bank;
+        }
+
+        // Table for a shape played at 'increment' cycles per sample. The octave is the highest one whose harmonics
+        // all stay under half the sample rate
+        const float *Select(const int shape, const double increment) const {
+            unsigned int octave = 0;
+            double limit = 0.25;
+            while (octave + 1 < WAVETABLE_OCTAVES && std::fabs(increment) <= limit) {
+                octave++;
+                limit *= 0.5;
+            }
+            return Table(shape, octave);
+        }
+
+    private:
+        // every table has one extra sample, a copy of the first, so the interpolation never wraps
+        std::vector<float> _tables;
+
+        WavetableBank() : _tables(static_cast<size_t>(WAVETABLE_SHAPES) * WAVETABLE_OCTAVES * (WAVETABLE_SIZE + 1)) {
+            for (int shape = 0; shape < WAVETABLE_SHAPES; shape++)
+                Build(shape);
+        }
+
+        const float *Table(const int shape, const unsigned int octave) const {
+            return _tables.data() + (static_cast<size_t>(shape) * WAVETABLE_OCTAVES + octave) * (WAVETABLE_SIZE + 1);
+        }
+
+        // Fourier series of each shape with the same phase and level as the oscillators in SynthUtils.h. The octaves
+        // are built from the lowest harmonic count up, each one adds its new harmonics to the sum of the last one
+        void Build(const int shape) {
+            const double pi = 2.0 * std::acos(0.0);
+            std::vector<double> sum(WAVETABLE_SIZE, 0.0);
+            unsigned int harmonicsDone = 0;
+
+            for (unsigned int octave = 0; octave < WAVETABLE_OCTAVES; octave++) {
+                const unsigned int harmonics = std::min(1u << octave, WAVETABLE_MAX_HARMONIC);
+
+                for (unsigned int n = harmonicsDone + 1; n <= harmonics; n++) {
+                    double gain;
+                    if (shape == WAVETABLE_SAW)
+                        gain = 2.0 / (pi * n);
+                    else if (n % 2 == 0)
+                        continue;
+                    else if (shape == WAVETABLE_SQUARE)
+                        gain = 4.0 / (pi * n);
+                    else
+                        gain = (n % 4 == 1 ? 8.0 : -8.0) / (pi * pi * n * n);
+
+                    for (unsigned int i = 0; i < WAVETABLE_SIZE; i++)
+                        sum[i] += gain * std::sin(2.0 * pi * n * i / WAVETABLE_SIZE);
+                }
+                harmonicsDone = harmonics;
+
+                float *table = _tables.data() +
+                               (static_cast<size_t>(shape) * WAVETABLE_OCTAVES + octave) * (WAVETABLE_SIZE + 1);
+                for (unsigned int i = 0; i < WAVETABLE_SIZE; i++)
+                    table[i] = static_cast<float>(sum[i]);
+                table[WAVETABLE_SIZE] = table[0];
+            }
+        }
+    };
+
+    // Linear interpolation of a table at 'phase' cycles, from 0 to 1. WrapPhase can round a tiny negative phase up
+    // to exactly 1, which is the start of the table again
+    inline double WavetableLookup(const float *table, const double &phase) {
+        const double position = phase * WAVETABLE_SIZE;
+        const auto whole = static_cast<unsigned int>(position);
+        const double fraction = position - whole;
+        const unsigned int index = whole & (WAVETABLE_SIZE - 1);
+        return table[index] + fraction * (table[index + 1] - table[index]);
+    }
+}
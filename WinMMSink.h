@@ -0,0 +1,182 @@
+/*
+	This file contains the Windows output of the audio engine, built on top of the winmm wave out API
+*/
+#pragma once
+
+//Might need to uncomment to run on Visual Studio
+//#pragma comment(lib, "winmm.lib")
+
+#include <algorithm>
+#include <atomic>
+#include <malloc.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <Windows.h>
+#include "AudioSink.h"
+#include "SpscRing.h"
+
+class WinMMAudioSink : public IAudioSink {
+public:
+    explicit WinMMAudioSink(std::wstring outputDevice) : _outputDevice(std::move(outputDevice)) {
+    }
+
+    ~WinMMAudioSink() override { Close(); }
+
+    // The rings keep their counters on cache lines of their own, a plain new only honours that from C++17
+    static void *operator new(const size_t bytes) {
+        void *memory = _aligned_malloc(bytes, alignof(WinMMAudioSink));
+        if (memory == nullptr)
+            throw std::bad_alloc();
+        return memory;
+    }
+
+    static void operator delete(void *memory) { _aligned_free(memory); }
+
+    static std::vector<std::wstring> Enumerate() {
+        const unsigned int deviceCount = waveOutGetNumDevs();
+        std::vector<std::wstring> devices;
+        WAVEOUTCAPS woc;
+
+        for (int n = 0; n < deviceCount; n++)
+            if (waveOutGetDevCaps(n, &woc, sizeof(WAVEOUTCAPS)) == S_OK)
+                devices.emplace_back(woc.szPname, woc.szPname + wcslen(reinterpret_cast<const wchar_t *>(woc.szPname)));
+
+        return devices;
+    }
+
+    bool Open(const AudioFormat &format, const unsigned int blockCount, const unsigned int blockSamples) override {
+        _blockCount = blockCount;
+        _blockBytes = blockSamples * format.BytesPerSample();
+        _currentHeader = nullptr;
+        _queuedBlocks = 0;
+        _queueLimit = blockCount;
+        _underruns = 0;
+
+        // Validate device
+        std::vector<std::wstring> devices = Enumerate();
+        const auto d = std::find(devices.begin(), devices.end(), _outputDevice);
+        if (d == devices.end())
+            return false;
+
+        const unsigned int nDeviceID = std::distance(devices.begin(), d);
+        WAVEFORMATEX waveFormat;
+        waveFormat.wFormatTag = format.IsFloat ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+        waveFormat.nSamplesPerSec = format.SampleRate;
+        waveFormat.wBitsPerSample = format.BitsPerSample;
+        waveFormat.nChannels = format.Channels;
+        waveFormat.nBlockAlign = (waveFormat.wBitsPerSample / 8) * waveFormat.nChannels;
+        waveFormat.nAvgBytesPerSec = waveFormat.nSamplesPerSec * waveFormat.nBlockAlign;
+        waveFormat.cbSize = 0;
+
+        // Open Device if valid
+        if (waveOutOpen(&_hwDevice, nDeviceID, &waveFormat, reinterpret_cast<DWORD_PTR>(WaveOutProcWrap),
+                        reinterpret_cast<DWORD_PTR>(this),CALLBACK_FUNCTION) != S_OK)
+            return false;
+
+        // Allocate Wave Block Memory
+        _blockMemory.assign(static_cast<size_t>(_blockCount) * _blockBytes, 0);
+        _waveHeaders.assign(_blockCount, WAVEHDR{});
+
+        // Link headers to block memory, at the start every block is free
+        _freeBlocks.Reset(_blockCount);
+        for (unsigned int n = 0; n < _blockCount; n++) {
+            _waveHeaders[n].dwBufferLength = _blockBytes;
+            _waveHeaders[n].lpData = _blockMemory.data() + n * _blockBytes;
+            _freeBlocks.TryPush(&_waveHeaders[n]);
+        }
+
+        _isOpen = true;
+        return true;
+    }
+
+    void Close() override {
+        if (!_isOpen)
+            return;
+
+        _isOpen = false;
+        waveOutReset(_hwDevice);
+        for (WAVEHDR &header: _waveHeaders)
+            if (header.dwFlags & WHDR_PREPARED)
+                waveOutUnprepareHeader(_hwDevice, &header, sizeof(WAVEHDR));
+        waveOutClose(_hwDevice);
+    }
+
+    void *AcquireBlock() override {
+        // Wait for block to become available and for the queue to drop below the limit, the device callback is
+        // the only one that frees blocks
+        while (!TryTakeBlock()) {
+            const uint32_t key = _blockFreed.PrepareWait();
+            if (TryTakeBlock()) {
+                _blockFreed.CancelWait();
+                break;
+            }
+            _blockFreed.Wait(key);
+        }
+
+        // Prepare block for processing
+        if (_currentHeader->dwFlags & WHDR_PREPARED)
+            waveOutUnprepareHeader(_hwDevice, _currentHeader, sizeof(WAVEHDR));
+
+        return _currentHeader->lpData;
+    }
+
+    void SubmitBlock() override {
+        // Send block to sound device
+        ++_queuedBlocks;
+        waveOutPrepareHeader(_hwDevice, _currentHeader, sizeof(WAVEHDR));
+        waveOutWrite(_hwDevice, _currentHeader, sizeof(WAVEHDR));
+    }
+
+    bool IsRealTime() const override { return true; }
+
+    unsigned int QueuedBlocks() const override { return _queuedBlocks; }
+
+    uint64_t Underruns() const override { return _underruns; }
+
+    void SetQueueLimit(const unsigned int blocks) override {
+        _queueLimit = std::min(std::max(blocks, 1u), _blockCount);
+        _blockFreed.Notify();
+    }
+
+private:
+    std::wstring _outputDevice;
+    HWAVEOUT _hwDevice{};
+    std::atomic<bool> _isOpen{};
+
+    unsigned int _blockCount{};
+    unsigned int _blockBytes{};
+    std::vector<char> _blockMemory;
+    std::vector<WAVEHDR> _waveHeaders;
+    WAVEHDR *_currentHeader{};
+
+    // Blocks the device is done with, pushed by the device callback and popped by the render thread
+    SpscRing<WAVEHDR *> _freeBlocks;
+    EventCount _blockFreed;
+    std::atomic<unsigned int> _queuedBlocks{};
+    std::atomic<unsigned int> _queueLimit{};
+    std::atomic<uint64_t> _underruns{};
+
+    bool TryTakeBlock() {
+        return _queuedBlocks < _queueLimit && _freeBlocks.TryPop(_currentHeader);
+    }
+
+    // Static wrapper for sound card handler
+    static void CALLBACK
+    WaveOutProcWrap(HWAVEOUT waveOut, UINT msg, DWORD_PTR instance, DWORD_PTR param1, DWORD_PTR param2) {
+        if (msg != WOM_DONE) return;
+
+        auto *sinkInstance = reinterpret_cast<WinMMAudioSink *>(instance);
+        sinkInstance->WaveOutProc(reinterpret_cast<WAVEHDR *>(param1));
+    }
+
+    // Handler for sound card request for more data, it never blocks
+    void WaveOutProc(WAVEHDR *header) {
+        // the device finished its last queued block before a new one arrived
+        if (--_queuedBlocks == 0 && _isOpen)
+            ++_underruns;
+
+        _freeBlocks.TryPush(header);
+        _blockFreed.Notify();
+    }
+};